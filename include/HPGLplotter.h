@@ -74,9 +74,54 @@ extern gboolean   bOptOffline;
 #define CLEAR   ( 0)
 
 gpointer        threadGPIB (gpointer);
+gpointer        threadRender (gpointer);
 
 #define NUM_HPGL_PENS   9      // white (pen 0) + 8
 
+typedef struct _HPGLParser tHPGLParser;
+
+// HPGL compiled into a serial stream of CHPGL records
+typedef struct {
+    guchar  *data;
+    gsize   length;                         // bytes of compiled HPGL
+    gsize   allocated;                      // bytes allocated for data
+    gsize   complete;                       // bytes of whole commands (may be drawn while more is added)
+    guint   generation;                     // changed whenever the compiled HPGL is emptied
+    GMutex  *pMutex;                        // held to move data or change complete (NULL if not shared)
+} tCompiledHPGL;
+
+// Compiled HPGL for the GPIB thread (the only writer of the plot) to add to the plot
+typedef struct {
+    tCompiledHPGL   plotHPGL;               // (taken over by the GPIB thread)
+    gboolean        bClear;                 // empty the plot first
+} tPlotAddition;
+
+// A copy of what is drawn (so a plot can be drawn away from the main thread)
+typedef struct {
+    tCompiledHPGL   plotHPGL;
+    GdkRGBA         HPGLpens[ NUM_HPGL_PENS ];
+    tCoord          HPGLplotterP1P2[2];         // The plotter sheet
+} tPlotSnapshot;
+
+enum eFileType { ePDF, eSVG, ePNG, eAllFormats };
+enum ePNGformat { ePNGcolour, ePNGpalette, ePNGmonochrome };
+
+// An export of the plot to a file (written away from the main loop)
+typedef struct {
+    gchar           *sFilename;
+    gchar           *sBasename;             // (for the status bar)
+    enum eFileType  fileType;
+    gdouble         width, height;          // of the page or image
+    gboolean        bPortrait;
+    gdouble         aspectRatio;
+    gint            paperSize;              // (of a PDF or SVG page)
+    enum ePNGformat PNGformat;              // (of a PNG image)
+    gint            PNGcompression;         // deflate level (0 - 9)
+    gint            PNGsize;                // pixels on the long side of a PNG image
+    tPlotSnapshot   snapshot;               // the plot as it was when the export was started
+    gint            progressStep;           // progress last shown
+} tExportJob;
+
 typedef struct {
     struct {
         gushort bHPGLscaled				 : 1;
@@ -95,6 +140,40 @@ typedef struct {
     cairo_matrix_t intitalMatrix;
 } tPlotterState;
 
+// The state of the renderer between drawing parts of the compiled HPGL
+typedef struct {
+    gsize           HPGLserialCount;        // compiled HPGL drawn so far
+    tPlotterState   plotterState;
+    gdouble         areaWidth, areaHeight;  // plot area (after rotation & margin)
+    gdouble         dot;                    // dash unit
+    gint            HPGLpen;
+    gint            HPGLlineType;
+    gboolean        bPenDown, bFirstPoint;
+    cairo_matrix_t  matrix, fontMatrix;
+    gdouble         lineWidth;
+    cairo_path_t    *path;                  // path not yet stroked (pen still down)
+    gboolean        bBatchPens;             // stroke the lines of a pen together (set by the caller)
+    gboolean        bMergePaths;            // merge the lines of each pen into one path (set by the caller)
+    GPtrArray       *mergedPaths;           // the merged paths (see strokeMergedPaths())
+    gdouble         lodTolerance;           // simplify lines to this detail (set by the caller, 0 for none)
+    const tPlotSnapshot *pSnapshot;         // draw this, not the plot in tGlobal (set by the caller)
+    cairo_t         *penLayers[ NUM_HPGL_PENS ];    // draw each pen on its own layer (set by the caller)
+    guint           penLayersUsed;          // pens drawn on their layers (a bit for each pen)
+} tPlotRender;
+
+// A request to the render thread for an image of the plot on the screen
+typedef struct {
+    gint            serial;
+    gint            width, height;          // drawing area
+    gdouble         scale;                  // device pixels in a unit of the drawing area (HiDPI)
+    guint           epoch;                  // tGlobal plotEpoch
+    gboolean        bNewPlot;               // the compiled HPGL is of a new plot (not more of the last)
+    GBytes          *moreHPGL;              // compiled HPGL added since the last request
+    GdkRGBA         HPGLpens[ NUM_HPGL_PENS ];
+    guint           hiddenPens;             // pens not shown (a bit for each pen)
+    tCoord          HPGLplotterP1P2[2];
+} tRenderRequest;
+
 typedef struct {
 
     struct {
@@ -110,17 +189,20 @@ typedef struct {
         guint32 bAutoClear				        : 1;
         guint32 bPortrait				        : 1;
         guint32 bDoNotEnableSystemController    : 1;
-        guint32 bMuteGPIBreply                  : 1;
         guint32 bEOIonLF                        : 1;
         guint32 bOnline                         : 1;
     } flags;
     gint		PDFpaperSize;
+    enum ePNGformat PNGformat;
+    gint        PNGcompression;
+    gint        PNGsize;
 #define P1	0
 #define P2	1
     tCoord			HPGLplotterP1P2[2];			// The plotter sheet
     gdouble			aspectRatio;
 
     GdkRGBA HPGLpens[ NUM_HPGL_PENS ];
+    guint   hiddenPens;                     // pens not shown on the screen (a bit for each pen)
 
     gint	 		GPIBcontrollerIndex;
     gint			GPIBdevicePID;
@@ -140,13 +222,30 @@ typedef struct {
     GAsyncQueue 	*messageQueueToGPIB;
     guint           refreshTimer;
 
-    void 			*plotHPGL;				// Optimized HPGL - potentially better for redrawing plot on the screen
+    tCompiledHPGL   plotHPGL;				// Optimized HPGL - potentially better for redrawing plot on the screen
+    tHPGLParser     *pHPGLparser;           // Parser for the HPGL received over GPIB
     GString  		*verbatimHPGLplot;		// The HPGL as received
 
+    // The plot on the screen is drawn by the render thread (see renderThread.c)
+    GAsyncQueue     *messageQueueToRender;
+    GThread         *pRenderThread;
+    tRenderRequest  plotRequested;          // the last request to the render thread (main thread only)
+    gsize           plotRequestedLength;    // compiled HPGL sent to the render thread
+    guint           plotRequestedGeneration;
+    guint           plotEpoch;              // changed when the plot must be drawn again (i.e. plotter sheet)
+    gint            plotStaleSerial;        // frames of earlier requests are stale (atomic)
+    GMutex          plotFrameMutex;
+    GMutex          plotHPGLmutex;          // the lock of plotHPGL (see lockCompiledHPGL())
+    cairo_surface_t *plotFrame;             // newest image of the plot (from the render thread)
+    gint            plotFrameWidth, plotFrameHeight;    // drawing area it was drawn for
+    guint           plotResizeTimer;        // the drawing area is being resized (the size has not settled)
+    gint            plotResizeWidth, plotResizeHeight;  // size it is being resized to
+
     gchar			*sUsersHPGLfilename;	// filename chose by user for saving HPGL file
     gchar			*sUsersPDFImageFilename;	// filename chosen by user for PDF file
     gchar			*sUsersPNGImageFilename;	// filename chosen by user for PNG file
     gchar			*sUsersSVGImageFilename;	// filename chosen by user for SVG file
+    gchar			*sUsersAllImageFilename;	// filename chosen by user for all formats (no extension)
     GTimer   		*timeSinceLastHPGLcommand;
     GThread 		*pGThread;
 
@@ -163,7 +262,13 @@ typedef enum { PAYLOAD_ONLY=0,   CHPGL_MOVE=1,      CHPGL_RMOVE=2,
     CHPGL_PEN_UP=3,   CHPGL_PEN_DOWN=4,  CHPGL_PEN=5,
     CHPGL_LINETYPE=6, CHPGL_TEXT_SIZE=7, CHPGL_LABEL=8,
     CHPGL_OP=9,       CHPGL_IP=10,       CHPGL_SCALING=12,
-    CHPGL_ROTATION=13, CHPGL_UCHAR=14 } eHPGL;
+    CHPGL_ROTATION=13, CHPGL_UCHAR=14, CHPGL_POLYLINE=15,
+    CHPGL_RPOLYLINE=16 } eHPGL;
+#define CHPGL_OPCODE_SIZE   sizeof( guint8 )    // the CHPGL byte (eHPGL) in the compiled stream
+#define CHPGL_MAX_POLYLINE  G_MAXUINT16         // points in one CHPGL_POLYLINE / CHPGL_RPOLYLINE
+// A CHPGL_LABEL is a (guint16) count of runs of text. Each run is the cursor move that follows
+// the text (guint8 eHPGLlabelMove), the (guint16) length and the text (null terminated)
+typedef enum { LABEL_END=0, LABEL_BACKSPACE='\b', LABEL_LINE_FEED='\n', LABEL_REVERSE_LINE_FEED='\v' } eHPGLlabelMove;
     typedef enum { SCALING_NONE=0, SCALING_ANISOTROPIC=1, SCALING_ISOTROPIC=2, SCALING_POINT=3, SCALING_ISOTROLIC_LB=4 } eHPGLscalingType;
 
     // The subset of HPGL commands that the 8753 provides are the following
@@ -198,8 +303,47 @@ typedef enum { PAYLOAD_ONLY=0,   CHPGL_MOVE=1,      CHPGL_RMOVE=2,
 
 #define QUANTIZE(x, y) ((gint)(((gdouble)(x)/(y))+1) * y)
 
-    gboolean parseHPGLcmd( guint16 HPGLcmd, gchar *sHPGLargs, tGlobal *pGlobal );
+// The state of the parser for one stream of HPGL (i.e. from GPIB or a recalled file)
+struct _HPGLParser {
+    struct {
+        guint32 bReplyToInstrument  : 1;    // answer OE, OP & OS over GPIB
+        guint32 bWorker             : 1;    // parsing a piece of a stream on a worker thread
+    } flags;
+
+    guint16     HPGLcmd;                    // command being collected
+    GString     *HPGLcmdArgs;               // arguments of a command split across buffers
+    GString     *label;                     // label being translated (reused)
+    gchar       labelTerminator;            // DT
+    gboolean    bAbsolutePoint;             // PA or PR
+    gboolean    bPenParked;                 // SP0 often indicates the end of a plot
+    gfloat      charSizeX, charSizeY;       // SR
+    guint8      colour;                     // SP
+    guint8      lineType;                   // LT
+    gint        characterSet;               // CS
+    guint8      modalSet;                   // HPGL_MODAL_... set by this parser
+    guint8      modalUsed;                  // HPGL_MODAL_... used before being set by this parser
+    guint64     nHPGLcommands;              // commands parsed (statistics)
+
+    tCompiledHPGL *pCompiledHPGL;           // the compiled HPGL we add to
+    tGlobal     *pGlobal;
+};
+
+    tHPGLParser *newHPGLparser( tCompiledHPGL *pCompiledHPGL, gboolean bReplyToInstrument, tGlobal *pGlobal );
+    void freeHPGLparser( tHPGLParser *pParser );
+    void resetHPGLparser( tHPGLParser *pParser );
+    gboolean parseHPGLcmd( tHPGLParser *pParser, guint16 HPGLcmd, const gchar *sHPGLargs, gsize argsLength );
+    gboolean parseHPGLstream( tHPGLParser *pParser, const gchar *sHPGL, gsize length );
+    gboolean parseHPGLstreamParallel( tHPGLParser *pParser, const gchar *sHPGL, gsize length );
     gboolean deserializeHPGL( gchar *sHPGL, tGlobal *pGlobal );
+    gboolean deserializeHPGL_n( const gchar *sHPGL, gsize length, tGlobal *pGlobal );
+    guchar *reserveCompiledHPGL( tCompiledHPGL *pCompiledHPGL, gsize size );
+    void clearCompiledHPGL( tCompiledHPGL *pCompiledHPGL );
+    void freeCompiledHPGL( tCompiledHPGL *pCompiledHPGL );
+    void appendCompiledHPGL( tCompiledHPGL *pCompiledHPGL, tCompiledHPGL *pCompiledHPGLmore );
+    void completeCompiledHPGL( tCompiledHPGL *pCompiledHPGL );
+    void lockCompiledHPGL( tCompiledHPGL *pCompiledHPGL );
+    void unlockCompiledHPGL( tCompiledHPGL *pCompiledHPGL );
+    gsize nextCompiledHPGL( const guchar *plotHPGL, gsize at );
     void initializeHPGL( tGlobal *pGlobal, gboolean bLandscape );
     void CB_DrawingArea_Draw (GtkDrawingArea *widget, cairo_t *cr, gint areaWidth, gint areaHeight, gpointer pGlobal);
 
@@ -262,9 +406,12 @@ typedef enum { PAYLOAD_ONLY=0,   CHPGL_MOVE=1,      CHPGL_RMOVE=2,
     void CB_btn_PDF        ( GtkButton* wBtnOptions, gpointer user_data );
     void CB_btn_PNG        ( GtkButton* wBtnOptions, gpointer user_data );
     void CB_btn_SVG        ( GtkButton* wBtnOptions, gpointer user_data );
+    void CB_btn_ExportAll  ( GtkButton* wBtnOptions, gpointer user_data );
     void CB_btn_OK         ( GtkButton* wBtnOK, gpointer user_data );
     void CB_color_Pen      ( GtkColorButton* wColorBtn, gpointer user_data );
     void CB_btn_ColorReset ( GtkButton* wBtnColorReset, gpointer user_data );
+    void CB_chk_PenShow    ( GtkCheckButton* wBtnPenShow, gpointer user_data );
+    void CB_chk_PNGformat  ( GtkCheckButton* wBtnPNGformat, gpointer user_data );
     void CB_chk_UseControllerName ( GtkCheckButton* wBtnUseControllerName, gpointer user_data );
     void initializeOptionsDialog( tGlobal *pGlobal );
     gint saveSettings      ( tGlobal *pGlobal );
@@ -276,6 +423,18 @@ typedef enum { PAYLOAD_ONLY=0,   CHPGL_MOVE=1,      CHPGL_RMOVE=2,
     void drawHPlogo (cairo_t *cr, gdouble centreX, gdouble lowerLeftY, gdouble scale);
 
     gboolean plotCompiledHPGL (cairo_t *cr, gdouble areaWidth, gdouble areaHeight, tGlobal *pGlobal);
+    void plotCompiledHPGLfrom (cairo_t *cr, gdouble areaWidth, gdouble areaHeight, gsize length,
+            tPlotRender *pRender, tGlobal *pGlobal);
+    void freePlotRender( tPlotRender *pRender );
+    void copyPlotRender( tPlotRender *pTo, const tPlotRender *pFrom );
+    void appendPlotRenderState( GByteArray *pState, const tPlotRender *pRender );
+    void strokeMergedPaths( cairo_t *cr, tPlotRender *pRender, tGlobal *pGlobal );
+    void freeLabelFontCache( void );
     void clearHPGL( tGlobal *pGlobal );
+    void clearVerbatimHPGL( tGlobal *pGlobal );
+    void invalidatePlotCache( tGlobal *pGlobal );
+    void takePlotSnapshot( tPlotSnapshot *pSnapshot, tGlobal *pGlobal );
+    gboolean writePNGinBands( tExportJob *pJob, tGlobal *pGlobal, GError **err );
+    void postExportProgress( tExportJob *pJob, gdouble fraction );
 
 #define GSETTINGS_SCHEMA	"us.heterodyne.HPGLplotter"
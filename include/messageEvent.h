@@ -40,9 +40,13 @@ enum _threadmessage
     TG_LISTEN, 							// listen for connections
 
     TG_UTILITY,
+    TG_ADD_PLOT,                        // add compiled HPGL to the plot (data is a tPlotAddition)
     TG_ABORT,
     TG_OFFLINE,
-    TG_END								// end thread
+    TG_END,								// end thread
+
+    TR_RENDER,                          // draw the plot for the screen (data is a tRenderRequest)
+    TR_END                              // end render thread
 };
 
 typedef struct
@@ -80,71 +80,258 @@ showUserChar ( cairo_t *cr, tCoordFloat *pLabel, gint nPoints ) {
 #define Y_HPGL_TO_CAIRO_EM  1.5
 #define LF_SCALE (2.1/Y_HPGL_TO_CAIRO_EM)
 
+// Labels are drawn as glyphs. The scaled fonts (one for each size, direction
+// and rotation of the text) are cached, and each scaled font keeps the glyphs of
+// the text already shown with it. The caches are shared by all the renderers.
+#define FONT_CACHE_MAX_FONTS    64      // scaled fonts kept
+#define FONT_CACHE_MAX_TEXTS    1024    // texts kept for each scaled font
+#define GLYPHS_ON_STACK         128
+
+typedef struct {
+    gint            nGlyphs;
+    gdouble         advanceX, advanceY;     // where the current point is left after the text
+    cairo_glyph_t   glyphs[];               // positioned from 0,0
+} tGlyphRun;
+
+// the font matrix and the CTM (without translation) of a scaled font
+typedef struct {
+    gdouble         matrix[ 10 ];
+} tFontKey;
+
+G_LOCK_DEFINE_STATIC( fontCache );
+static GHashTable *fontCache = NULL;                // tFontKey -> cairo_scaled_font_t
+static cairo_font_face_t *HPGLfontFace = NULL;
+static cairo_font_options_t *HPGLfontOptions = NULL;
+static const cairo_user_data_key_t glyphRunsKey;    // the text -> tGlyphRun table of a scaled font
+
+static guint
+hashFontKey( gconstpointer pKey ) {
+    const guchar *pByte = pKey;
+    guint hash = 2166136261u;
+
+    for( gint i = 0; i < sizeof( tFontKey ); i++ )
+        hash = (hash ^ pByte[ i ]) * 16777619u;
+    return hash;
+}
+
+static gboolean
+equalFontKey( gconstpointer pKeyA, gconstpointer pKeyB ) {
+    return memcmp( pKeyA, pKeyB, sizeof( tFontKey ) ) == 0;
+}
+
+/*!     \brief  Create the font face and options used for labels (once)
+ */
 static void
-showLabel ( cairo_t *cr, gchar *pLabel) {
-    gdouble startX, startY;
-    cairo_matrix_t fontMatrix;
-    cairo_text_extents_t fontExtents;
-    int i, j;
+initHPGLfont( void ) {
+    static gsize bInitialized = 0;
+
+    if( g_once_init_enter( &bInitialized ) ) {
+        // Use a font that is monospaced (like the HP vector plotter)
+        // Noto Sans Mono Light
+        HPGLfontFace = cairo_toy_font_face_create( HPGL_FONT, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL );
+        HPGLfontOptions = cairo_font_options_create();
+        cairo_font_options_set_hint_style( HPGLfontOptions, CAIRO_HINT_STYLE_NONE );
+        cairo_font_options_set_hint_metrics( HPGLfontOptions, CAIRO_HINT_METRICS_OFF );
+        g_once_init_leave( &bInitialized, 1 );
+    }
+}
 
-    GString *strLabel = g_string_new ( pLabel );
+/*!     \brief  Get the scaled font for the font matrix and transformation of the context
+ *
+ * \param cr        pointer to cairo context
+ * \return scaled font (a reference the caller must release)
+ */
+static cairo_scaled_font_t *
+getScaledFont( cairo_t *cr ) {
+    cairo_matrix_t fontMatrix, ctm;
+    cairo_scaled_font_t *pScaledFont;
+    tFontKey key;
+
+    cairo_get_font_matrix( cr, &fontMatrix );
+    cairo_get_matrix( cr, &ctm );
+    ctm.x0 = ctm.y0 = 0.0;
+    key = (tFontKey){ { fontMatrix.xx, fontMatrix.yx, fontMatrix.xy, fontMatrix.yy, fontMatrix.x0, fontMatrix.y0,
+                        ctm.xx, ctm.yx, ctm.xy, ctm.yy } };
+
+    G_LOCK( fontCache );
+    if( fontCache == NULL )
+        fontCache = g_hash_table_new_full( hashFontKey, equalFontKey, g_free,
+                (GDestroyNotify)cairo_scaled_font_destroy );
+    pScaledFont = g_hash_table_lookup( fontCache, &key );
+    if( pScaledFont == NULL ) {
+        if( g_hash_table_size( fontCache ) >= FONT_CACHE_MAX_FONTS )
+            g_hash_table_remove_all( fontCache );
+        tFontKey *pKey = g_new( tFontKey, 1 );
+
+        *pKey = key;
+        pScaledFont = cairo_scaled_font_create( HPGLfontFace, &fontMatrix, &ctm, HPGLfontOptions );
+        g_hash_table_insert( fontCache, pKey, pScaledFont );
+    }
+    cairo_scaled_font_reference( pScaledFont );
+    G_UNLOCK( fontCache );
 
-    // replace composite zero stroke with zero
-    g_string_replace ( strLabel, "0\b/", "0", 0 );
+    return pScaledFont;
+}
 
-    // Remove any NOPs from the string (see HP7475A Interfacing & Programming Manual (C8 7475 ASCII Code Definitions)
-    for( i=0, j=0; i < strLabel->len; i++ ) {
-        gchar ch = strLabel->str[i];
-        if( !( (ch >= 4 && ch <= 7)
-                || (ch >= 16 && ch <= 31)
-                || ch == 1 || ch == 2 ) )
-            strLabel->str[j++] = ch;
+/*!     \brief  Discard the cached scaled fonts and glyphs
+ */
+void
+freeLabelFontCache( void ) {
+    G_LOCK( fontCache );
+    if( fontCache )
+        g_hash_table_destroy( fontCache );
+    fontCache = NULL;
+    G_UNLOCK( fontCache );
+}
+
+/*!     \brief  Get the glyphs of some text in a scaled font (converting the text the first time)
+ *
+ * Must be called with the font cache locked.
+ *
+ * \param pScaledFont   scaled font
+ * \param sText         the text (null terminated)
+ * \param length        length of the text
+ * \return the glyphs or NULL if the text could not be converted
+ */
+static tGlyphRun *
+getGlyphRun( cairo_scaled_font_t *pScaledFont, const gchar *sText, gint length ) {
+    GHashTable *pGlyphRuns = cairo_scaled_font_get_user_data( pScaledFont, &glyphRunsKey );
+    cairo_glyph_t *pGlyphs = NULL;
+    cairo_text_extents_t extents;
+    tGlyphRun *pGlyphRun;
+    gint nGlyphs = 0;
+
+    if( pGlyphRuns == NULL ) {
+        pGlyphRuns = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, g_free );
+        if( cairo_scaled_font_set_user_data( pScaledFont, &glyphRunsKey, pGlyphRuns,
+                (cairo_destroy_func_t)g_hash_table_destroy ) != CAIRO_STATUS_SUCCESS ) {
+            g_hash_table_destroy( pGlyphRuns );
+            return NULL;
+        }
+    } else if( (pGlyphRun = g_hash_table_lookup( pGlyphRuns, sText )) != NULL ) {
+        return pGlyphRun;
     }
-    strLabel->str[j] = 0;
 
-    g_string_replace ( strLabel, "\x1E", "", 0 );
-    g_string_replace ( strLabel, "\x1D", "", 0 );
+    if( cairo_scaled_font_text_to_glyphs( pScaledFont, 0.0, 0.0, sText, length,
+            &pGlyphs, &nGlyphs, NULL, NULL, NULL ) != CAIRO_STATUS_SUCCESS || nGlyphs == 0 ) {
+        cairo_glyph_free( pGlyphs );
+        return NULL;
+    }
 
-    cairo_text_extents ( cr, "0", &fontExtents);
+    pGlyphRun = g_malloc( sizeof( tGlyphRun ) + nGlyphs * sizeof( cairo_glyph_t ) );
+    pGlyphRun->nGlyphs = nGlyphs;
+    memcpy( pGlyphRun->glyphs, pGlyphs, nGlyphs * sizeof( cairo_glyph_t ) );
+    // as cairo_show_text, leave the current point after the advance of the last glyph
+    cairo_scaled_font_glyph_extents( pScaledFont, &pGlyphs[ nGlyphs - 1 ], 1, &extents );
+    pGlyphRun->advanceX = pGlyphs[ nGlyphs - 1 ].x + extents.x_advance;
+    pGlyphRun->advanceY = pGlyphs[ nGlyphs - 1 ].y + extents.y_advance;
+    cairo_glyph_free( pGlyphs );
 
-    gchar *pStartChunk, *pEndChunk;
-    gboolean bEnd = FALSE;
-    gint thisLine;
+    if( g_hash_table_size( pGlyphRuns ) >= FONT_CACHE_MAX_TEXTS )
+        g_hash_table_remove_all( pGlyphRuns );
+    g_hash_table_insert( pGlyphRuns, g_strndup( sText, length ), pGlyphRun );
+
+    return pGlyphRun;
+}
+
+/*!     \brief  Show text at the current point (and move past it)
+ *
+ * \param cr            pointer to cairo context (with the scaled font set)
+ * \param pScaledFont   the scaled font
+ * \param sText         the text (null terminated)
+ * \param length        length of the text
+ */
+static void
+showText( cairo_t *cr, cairo_scaled_font_t *pScaledFont, const gchar *sText, gint length ) {
+    cairo_glyph_t glyphsOnStack[ GLYPHS_ON_STACK ], *pGlyphs = glyphsOnStack;
+    gdouble x, y, advanceX = 0.0, advanceY = 0.0;
+    tGlyphRun *pGlyphRun;
+    gint nGlyphs = 0;
+
+    cairo_get_current_point( cr, &x, &y );
+
+    // the glyphs are copied (and positioned) so the cache is not held while drawing
+    G_LOCK( fontCache );
+    pGlyphRun = getGlyphRun( pScaledFont, sText, length );
+    if( pGlyphRun ) {
+        nGlyphs = pGlyphRun->nGlyphs;
+        if( nGlyphs > GLYPHS_ON_STACK )
+            pGlyphs = g_new( cairo_glyph_t, nGlyphs );
+        for( gint i = 0; i < nGlyphs; i++ ) {
+            pGlyphs[ i ].index = pGlyphRun->glyphs[ i ].index;
+            pGlyphs[ i ].x = x + pGlyphRun->glyphs[ i ].x;
+            pGlyphs[ i ].y = y + pGlyphRun->glyphs[ i ].y;
+        }
+        advanceX = pGlyphRun->advanceX;
+        advanceY = pGlyphRun->advanceY;
+    }
+    G_UNLOCK( fontCache );
+
+    if( pGlyphRun ) {
+        cairo_show_glyphs( cr, pGlyphs, nGlyphs );
+        cairo_move_to( cr, x + advanceX, y + advanceY );
+    } else {
+        cairo_show_text( cr, sText );
+    }
+
+    if( pGlyphs != glyphsOnStack )
+        g_free( pGlyphs );
+}
+
+/*!     \brief  Show a label
+ *
+ * The label was tidied and split into runs of text and cursor moves when it
+ * was compiled (see HPGLcmd_LB), so it is shown without any copying.
+ *
+ * \param cr            pointer to cairo context (with the scaled font set)
+ * \param pScaledFont   the scaled font
+ * \param pRuns         pointer to the runs of the label in the compiled HPGL
+ * \param nRuns         number of runs
+ * \return pointer to the compiled HPGL following the label
+ */
+static const guchar *
+showLabel ( cairo_t *cr, cairo_scaled_font_t *pScaledFont, const guchar *pRuns, guint nRuns ) {
+    gdouble startX, startY;
+    cairo_matrix_t fontMatrix;
+    cairo_text_extents_t fontExtents;
+    gboolean bFontExtents = FALSE;
+    gint thisLine = 0;
 
     cairo_get_font_matrix ( cr, &fontMatrix );
     cairo_get_current_point ( cr, &startX, &startY );
     cairo_move_to( cr, startX, startY  );
-    for( pStartChunk = pEndChunk = strLabel->str, thisLine = 0;
-            !bEnd && *pStartChunk != 0;
-            pStartChunk = ++pEndChunk  ) {
-        gchar terminator;
-        while( *pEndChunk != 0 && *pEndChunk != '\n' && *pEndChunk != '\b' && *pEndChunk != '\v' ) {
-            pEndChunk++;
-        }
-        terminator = *pEndChunk;
-        *pEndChunk = 0;
-        cairo_show_text ( cr, pStartChunk );
+    for( ; nRuns > 0; nRuns-- ) {
+        eHPGLlabelMove move = *pRuns;
+        guint16 runLength;
+
+        memcpy( &runLength, pRuns + sizeof( guint8 ), sizeof( guint16 ) );
+        if( runLength > 0 )
+            showText ( cr, pScaledFont, (const gchar *)pRuns + sizeof( guint8 ) + sizeof( guint16 ), runLength );
+        pRuns += sizeof( guint8 ) + sizeof( guint16 ) + runLength + 1;
 
-        switch( terminator ) {
+        switch( move ) {
         default:
-        case 0:
-            bEnd = TRUE;
+        case LABEL_END:
             break;
-        case '\n':      // line feed (also do carriage return)
+        case LABEL_LINE_FEED:           // line feed (also do carriage return)
             thisLine++;
             cairo_move_to( cr, startX, startY + thisLine * fontMatrix.yy * LF_SCALE );
             break;
-        case '\v':      // Verical tab (reverse line feed)
+        case LABEL_REVERSE_LINE_FEED:   // Verical tab (reverse line feed)
             thisLine--;
             cairo_rel_move_to( cr, 0, -fontMatrix.yy );
             break;
-        case '\b':      // back space
+        case LABEL_BACKSPACE:           // back space
+            if( !bFontExtents ) {
+                cairo_text_extents ( cr, "0", &fontExtents);
+                bFontExtents = TRUE;
+            }
             cairo_rel_move_to( cr, -fontExtents.x_advance, 0 );
             break;
         }
     }
 
-    g_string_free( strLabel, TRUE );
+    return pRuns;
 }
 
 static void
@@ -245,6 +432,40 @@ translateHPGLpointToCairo( tCoord *HPGLpoint,
     *pCairoY *= cairoScaleFactorY;
 }
 
+/*!     \brief  Get the scale and offset to translate HPGL points to cairo
+ *
+ * The same as translateHPGLpointToCairo() for a run of points, i.e.
+ *   cairoX = HPGLx * scaleX + offsetX
+ *   cairoY = HPGLy * scaleY + offsetY
+ */
+static void
+getHPGLtoCairoTransform( gdouble cairoWidth, gdouble cairoHeight,
+        gdouble *pScaleX, gdouble *pOffsetX, gdouble *pScaleY, gdouble *pOffsetY,
+        tPlotterState *plotterState, gdouble bScaleOnly ) {
+    gdouble cairoScaleFactorX, cairoScaleFactorY;
+
+    cairoScaleFactorX = cairoWidth  / (gdouble)(plotterState->widthTransformed);
+    cairoScaleFactorY = cairoHeight / (gdouble)(plotterState->heightTransformed);
+
+    if( plotterState->flags.bHPGLscaled ) {
+        gdouble rangeX = (gdouble)(plotterState->HPGLinputP1P2[ P2 ].x - plotterState->HPGLinputP1P2[ P1 ].x) /
+                (gdouble)(plotterState->HPGLscaledP1P2[ P2 ].x - plotterState->HPGLscaledP1P2[ P1 ].x);
+        gdouble rangeY = (gdouble)(plotterState->HPGLinputP1P2[ P2 ].y - plotterState->HPGLinputP1P2[ P1 ].y) /
+                (gdouble)(plotterState->HPGLscaledP1P2[ P2 ].y - plotterState->HPGLscaledP1P2[ P1 ].y);
+
+        *pScaleX  = rangeX * cairoScaleFactorX;
+        *pScaleY  = rangeY * cairoScaleFactorY;
+        *pOffsetX = (plotterState->HPGLinputP1P2[ P1 ].x
+                - (bScaleOnly ? 0 : plotterState->HPGLscaledP1P2[ P1 ].x) * rangeX) * cairoScaleFactorX;
+        *pOffsetY = (plotterState->HPGLinputP1P2[ P1 ].y
+                - (bScaleOnly ? 0 : plotterState->HPGLscaledP1P2[ P1 ].y) * rangeY) * cairoScaleFactorY;
+    } else {
+        *pScaleX  = cairoScaleFactorX;
+        *pScaleY  = cairoScaleFactorY;
+        *pOffsetX = *pOffsetY = 0.0;
+    }
+}
+
 static void
 translateHPGLfontSizeToCairo( gdouble HPGLcharSizeX, gdouble HPGLcharSizeY,
         gdouble cairoWidth, gdouble cairoHeight,
@@ -267,23 +488,528 @@ translateHPGLfontSizeToCairo( gdouble HPGLcharSizeX, gdouble HPGLcharSizeY,
 }
 
 
-#define EXTRACT( d, p, c, t ) { d = (*(t *)(p + c)); c += sizeof( t ); }
-#define EXTRACT_ARRAY( d, p, c, n, t ) { d = (t *)(p + c); c += (n * sizeof( t )); }
+// The lines of a pen and line type merged into one path (in device space)
+typedef struct {
+    gint            HPGLpen;
+    gdouble         lineWidth;
+    gint            nDashes;
+    gdouble         dashes[ 2 ];            // (the line type)
+    GArray          *data;                  // cairo_path_data_t of the path
+    gboolean        bMove;                  // a move not added yet (until a line is drawn from it)
+    gdouble         moveX, moveY;
+    gint            nLines;                 // lines since the last move
+    gdouble         x, y;                   // end of the path
+    gdouble         lastX, lastY;           // the point before (if there are lines)
+} tMergedPath;
+
+// Points of merged paths closer than this (in device space) are the same
+// (a line with a point off it by less is straight)
+#define MERGE_TOLERANCE     0.01
+
+static void
+freeMergedPath( gpointer pMergedPath ) {
+    tMergedPath *pMerged = pMergedPath;
 
+    g_array_free( pMerged->data, TRUE );
+    g_free( pMerged );
+}
 
-/*!     \brief  Display the 8753 screen image
+/*!     \brief  Find (or add) the merged path of a pen and line type
  *
- * If the plot is polar, draw the grid and legends.
- * If there is an overlay of two polar grids of the same scale show both,
- * otherwise actual grid is only drawn once.
+ * The line type is known by the dashes drawn (several HPGL line types are drawn solid).
  *
- * \ingroup drawing
+ * \param cr            pointer to cairo context (for the line width and dashes)
+ * \param pRender       pointer to the renderer state
+ * \param HPGLpen       the pen
+ * \return the merged path
+ */
+static tMergedPath *
+getMergedPath( cairo_t *cr, tPlotRender *pRender, gint HPGLpen ) {
+    gdouble dx = cairo_get_line_width( cr ), dy = 0.0;
+    gint nDashes = cairo_get_dash_count( cr );
+    gdouble *dashes = g_newa( gdouble, MAX( nDashes, 1 ) );
+    gdouble lineWidth, scale, dashOffset;
+    tMergedPath *pMerged;
+
+    if( HPGLpen >= NUM_HPGL_PENS )
+        HPGLpen = 1;        // (as drawn)
+
+    // the line width changes with rotation (and OP), so it is part of the key
+    cairo_user_to_device_distance( cr, &dx, &dy );
+    lineWidth = hypot( dx, dy );
+    scale = lineWidth / cairo_get_line_width( cr );
+    cairo_get_dash( cr, dashes, &dashOffset );
+    nDashes = MIN( nDashes, G_N_ELEMENTS( pMerged->dashes ) );
+    for( gint i = 0; i < nDashes; i++ )
+        dashes[ i ] *= scale;
+
+    if( pRender->mergedPaths == NULL )
+        pRender->mergedPaths = g_ptr_array_new_with_free_func( freeMergedPath );
+    for( guint i = 0; i < pRender->mergedPaths->len; i++ ) {
+        pMerged = g_ptr_array_index( pRender->mergedPaths, i );
+        if( pMerged->HPGLpen == HPGLpen && pMerged->nDashes == nDashes
+                && fabs( pMerged->lineWidth - lineWidth ) < MERGE_TOLERANCE
+                && (nDashes == 0 || fabs( pMerged->dashes[ 0 ] - dashes[ 0 ] ) < MERGE_TOLERANCE)
+                && (nDashes < 2 || fabs( pMerged->dashes[ 1 ] - dashes[ 1 ] ) < MERGE_TOLERANCE) )
+            return pMerged;
+    }
+
+    pMerged = g_new0( tMergedPath, 1 );
+    pMerged->HPGLpen = HPGLpen;
+    pMerged->lineWidth = lineWidth;
+    pMerged->nDashes = nDashes;
+    for( gint i = 0; i < nDashes; i++ )
+        pMerged->dashes[ i ] = dashes[ i ];
+    pMerged->data = g_array_new( FALSE, FALSE, sizeof( cairo_path_data_t ) );
+    g_ptr_array_add( pRender->mergedPaths, pMerged );
+
+    return pMerged;
+}
+
+/*!     \brief  Add an element (and its point) to a merged path
+ *
+ * \param pMerged   pointer to the merged path
+ * \param type      CAIRO_PATH_MOVE_TO or CAIRO_PATH_LINE_TO
+ * \param x         the point
+ * \param y
+ */
+static void
+appendMergedPath( tMergedPath *pMerged, cairo_path_data_type_t type, gdouble x, gdouble y ) {
+    cairo_path_data_t data[ 2 ];
+
+    data[ 0 ].header.type = type;
+    data[ 0 ].header.length = 2;
+    data[ 1 ].point.x = x;
+    data[ 1 ].point.y = y;
+    g_array_append_vals( pMerged->data, data, 2 );
+}
+
+/*!     \brief  Add a line to a merged path
+ *
+ * A line from where the path ends carries on the path (without a move).
+ * Lines of no length are left out and a line carrying on in the
+ * direction of the last only moves its end.
+ *
+ * \param pMerged   pointer to the merged path
+ * \param x         end of the line
+ * \param y
+ */
+static void
+mergeLineTo( tMergedPath *pMerged, gdouble x, gdouble y ) {
+    if( pMerged->bMove ) {
+        pMerged->bMove = FALSE;
+        if( pMerged->data->len == 0 || fabs( pMerged->moveX - pMerged->x ) >= MERGE_TOLERANCE
+                || fabs( pMerged->moveY - pMerged->y ) >= MERGE_TOLERANCE ) {
+            appendMergedPath( pMerged, CAIRO_PATH_MOVE_TO, pMerged->moveX, pMerged->moveY );
+            pMerged->x = pMerged->moveX;
+            pMerged->y = pMerged->moveY;
+            pMerged->nLines = 0;
+        }
+    } else if( pMerged->data->len == 0 ) {
+        return;     // (a path always starts with a move)
+    }
+
+    gdouble ax = pMerged->x - pMerged->lastX, ay = pMerged->y - pMerged->lastY;
+    gdouble bx = x - pMerged->x, by = y - pMerged->y;
+
+    if( fabs( bx ) < MERGE_TOLERANCE && fabs( by ) < MERGE_TOLERANCE )
+        return;
+
+    if( pMerged->nLines > 0 && ax * bx + ay * by > 0.0
+            && fabs( ax * by - ay * bx ) < MERGE_TOLERANCE * hypot( ax + bx, ay + by ) ) {
+        // straight on .. move the end of the last line
+        cairo_path_data_t *pLast = &g_array_index( pMerged->data, cairo_path_data_t, pMerged->data->len - 1 );
+
+        pLast->point.x = x;
+        pLast->point.y = y;
+    } else {
+        appendMergedPath( pMerged, CAIRO_PATH_LINE_TO, x, y );
+        pMerged->lastX = pMerged->x;
+        pMerged->lastY = pMerged->y;
+        pMerged->nLines++;
+    }
+    pMerged->x = x;
+    pMerged->y = y;
+}
+
+/*!     \brief  Merge the lines batched for a pen into the path of the pen and line type
+ *
+ * The path of the cairo context is cleared.
+ *
+ * \param cr            pointer to cairo context
+ * \param pRender       pointer to the renderer state
+ * \param HPGLpen       the pen
+ */
+static void
+mergePenBatch( cairo_t *cr, tPlotRender *pRender, gint HPGLpen ) {
+    cairo_path_t *path = cairo_copy_path_flat( cr );
+    tMergedPath *pMerged;
+    gdouble x, y, startX = 0.0, startY = 0.0;
+
+    if( path->num_data > 0 ) {
+        pMerged = getMergedPath( cr, pRender, HPGLpen );
+
+        for( gint i = 0; i < path->num_data; i += path->data[ i ].header.length ) {
+            const cairo_path_data_t *pData = &path->data[ i ];
+
+            switch( pData->header.type ) {
+            case CAIRO_PATH_MOVE_TO:
+                x = pData[ 1 ].point.x;
+                y = pData[ 1 ].point.y;
+                cairo_user_to_device( cr, &x, &y );
+                pMerged->bMove = TRUE;
+                pMerged->moveX = startX = x;
+                pMerged->moveY = startY = y;
+                break;
+            case CAIRO_PATH_LINE_TO:
+                x = pData[ 1 ].point.x;
+                y = pData[ 1 ].point.y;
+                cairo_user_to_device( cr, &x, &y );
+                mergeLineTo( pMerged, x, y );
+                break;
+            case CAIRO_PATH_CLOSE_PATH:
+                mergeLineTo( pMerged, startX, startY );
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    cairo_path_destroy( path );
+    cairo_new_path( cr );
+}
+
+/*!     \brief  Stroke the lines batched for a pen (or merge them, if pRender->bMergePaths)
+ *
+ * \param cr            pointer to cairo context
+ * \param pRender       pointer to the renderer state
+ * \param HPGLpen       the pen
+ */
+static void
+strokeOrMergePenBatch( cairo_t *cr, tPlotRender *pRender, gint HPGLpen ) {
+    if( pRender->bMergePaths )
+        mergePenBatch( cr, pRender, HPGLpen );
+    else
+        cairo_stroke( cr );
+}
+
+/*!     \brief  Stroke the lines batched for a pen (keeping the current point)
+ *
+ * \param cr            pointer to cairo context
+ * \param pRender       pointer to the renderer state
+ * \param HPGLpen       the pen
+ */
+static void
+strokePenBatch( cairo_t *cr, tPlotRender *pRender, gint HPGLpen ) {
+    gdouble x, y;
+
+    if( cairo_has_current_point( cr ) ) {
+        cairo_get_current_point( cr, &x, &y );
+        strokeOrMergePenBatch( cr, pRender, HPGLpen );
+        cairo_move_to( cr, x, y );
+    } else {
+        strokeOrMergePenBatch( cr, pRender, HPGLpen );
+    }
+}
+
+/*!     \brief  Stroke the lines merged for each pen and line type
+ *
+ * Each is stroked as one path, after the plot has been drawn with pRender->bMergePaths.
+ *
+ * \param cr        pointer to cairo context (for the surface the plot was drawn on)
+ * \param pRender   pointer to the renderer state
+ * \param pGlobal   pointer to global data (for the pen colours, if there is no snapshot)
+ */
+void
+strokeMergedPaths( cairo_t *cr, tPlotRender *pRender, tGlobal *pGlobal ) {
+    const GdkRGBA *HPGLpens = pRender->pSnapshot ? pRender->pSnapshot->HPGLpens : pGlobal->HPGLpens;
+
+    if( pRender->mergedPaths == NULL )
+        return;
+
+    cairo_save( cr ); {
+        // the merged paths are in device space
+        cairo_identity_matrix( cr );
+        for( guint i = 0; i < pRender->mergedPaths->len; i++ ) {
+            tMergedPath *pMerged = g_ptr_array_index( pRender->mergedPaths, i );
+            cairo_path_t path = { CAIRO_STATUS_SUCCESS,
+                    (cairo_path_data_t *)pMerged->data->data, pMerged->data->len };
+
+            if( pMerged->data->len == 0 )
+                continue;
+            gdk_cairo_set_source_rgba( cr, &HPGLpens[ pMerged->HPGLpen ] );
+            cairo_set_line_width( cr, pMerged->lineWidth );
+            cairo_set_dash( cr, pMerged->dashes, pMerged->nDashes, 0.0 );
+            cairo_new_path( cr );
+            cairo_append_path( cr, &path );
+            cairo_stroke( cr );
+        }
+    } cairo_restore( cr );
+}
+
+/*!     \brief  Set the colour to draw with for a pen
+ *
+ * On pen layers every pen draws opaque; the colour is given when the layers
+ * are composited (so only the coverage of the pen is on its layer).
  *
  * \param cr        pointer to cairo context
- * \param pGrid     pointer to grid parameters
- * \param pGlobal   pointer to global data
- * \return          TRUE
+ * \param HPGLpens  the pen colours
+ * \param HPGLpen   the pen
+ * \param pRender   pointer to the renderer state
+ */
+static void
+setPenSource( cairo_t *cr, const GdkRGBA *HPGLpens, gint HPGLpen, tPlotRender *pRender ) {
+    if( pRender->penLayers[ 0 ] )
+        cairo_set_source_rgba( cr, 0.0, 0.0, 0.0, 1.0 );
+    else
+        gdk_cairo_set_source_rgba( cr, &HPGLpens[ HPGLpen ] );
+}
+
+/*!     \brief  Carry on drawing on the layer of a pen
+ *
+ * The state held in the cairo context (transformation, font, line width,
+ * dashes and the path with the current point) is moved to the layer.
+ *
+ * \param cr        pointer to cairo context being drawn on
+ * \param HPGLpen   the pen
+ * \param pRender   pointer to the renderer state
+ * \return          the cairo context of the layer of the pen
+ */
+static cairo_t *
+switchPenLayer( cairo_t *cr, gint HPGLpen, tPlotRender *pRender ) {
+    cairo_t *crLayer = pRender->penLayers[ HPGLpen ];
+    cairo_matrix_t matrix;
+    cairo_path_t *path;
+    gint nDashes;
+    gdouble *dashes, dashOffset;
+
+    pRender->penLayersUsed |= 1 << HPGLpen;
+    if( crLayer == cr )
+        return cr;
+
+    cairo_get_matrix( cr, &matrix );
+    cairo_set_matrix( crLayer, &matrix );
+    cairo_get_font_matrix( cr, &matrix );
+    cairo_set_font_matrix( crLayer, &matrix );
+    cairo_set_font_options( crLayer, HPGLfontOptions );
+    cairo_set_font_face( crLayer, cairo_get_font_face( cr ) );
+    cairo_set_line_width( crLayer, cairo_get_line_width( cr ) );
+    nDashes = cairo_get_dash_count( cr );
+    dashes = g_newa( gdouble, MAX( nDashes, 1 ) );
+    cairo_get_dash( cr, dashes, &dashOffset );
+    cairo_set_dash( crLayer, dashes, nDashes, dashOffset );
+
+    path = cairo_copy_path( cr );
+    cairo_new_path( cr );
+    cairo_new_path( crLayer );
+    cairo_append_path( crLayer, path );
+    cairo_path_destroy( path );
+
+    return crLayer;
+}
+
+// A line simplified to the resolution of the screen (see lineToLOD())
+typedef struct {
+    gdouble x, y;
+    gint    index;                      // order in the column
+} tLODpoint;
+
+typedef struct {
+    gdouble     tolerance;              // width of a column
+    gdouble     column;                 // column of the points being gathered
+    gboolean    bColumn;                // a point has been drawn in the column
+    gint        nPoints;                // points gathered (not drawn yet)
+    tLODpoint   min, max, last;
+} tLODcolumn;
+
+/*!     \brief  Draw the points gathered in the column of a simplified line
+ *
+ * \param cr        pointer to cairo context
+ * \param pLOD      pointer to the simplified line
+ */
+static void
+flushLODcolumn( cairo_t *cr, tLODcolumn *pLOD ) {
+    if( pLOD->nPoints > 0 ) {
+        // the lowest and highest points in the order they were reached, then the last
+        tLODpoint *pFirst  = pLOD->min.index < pLOD->max.index ? &pLOD->min : &pLOD->max;
+        tLODpoint *pSecond = pLOD->min.index < pLOD->max.index ? &pLOD->max : &pLOD->min;
+
+        if( pFirst->index != pLOD->last.index )
+            cairo_line_to( cr, pFirst->x, pFirst->y );
+        if( pSecond->index != pFirst->index && pSecond->index != pLOD->last.index )
+            cairo_line_to( cr, pSecond->x, pSecond->y );
+        cairo_line_to( cr, pLOD->last.x, pLOD->last.y );
+        pLOD->nPoints = 0;
+    }
+}
+
+/*!     \brief  Add a point to a line simplified to the resolution of the screen
+ *
+ * The line is cut into columns (tolerance wide). The first point in a column is
+ * drawn; of the rest only the lowest, the highest and the last are drawn.
+ * A dense trace is then drawn with a few points for each pixel and no
+ * part of it moves further than the width of a column.
+ * Call flushLODcolumn() after the last point.
+ *
+ * \param cr        pointer to cairo context
+ * \param pLOD      pointer to the simplified line
+ * \param x         point to draw a line to
+ * \param y
+ */
+static void
+lineToLOD( cairo_t *cr, tLODcolumn *pLOD, gdouble x, gdouble y ) {
+    gdouble column = floor( x / pLOD->tolerance );
+
+    if( pLOD->bColumn && column == pLOD->column ) {
+        tLODpoint point = { x, y, pLOD->nPoints++ };
+
+        if( point.index == 0 || y < pLOD->min.y )
+            pLOD->min = point;
+        if( point.index == 0 || y > pLOD->max.y )
+            pLOD->max = point;
+        pLOD->last = point;
+    } else {
+        flushLODcolumn( cr, pLOD );
+        cairo_line_to( cr, x, y );
+        pLOD->column = column;
+        pLOD->bColumn = TRUE;
+    }
+}
+
+// The compiled HPGL is not aligned, so values are copied out of it
+#define EXTRACT( d, p, c, t ) { t _v; memcpy( &_v, p + c, sizeof( t ) ); d = _v; c += sizeof( t ); }
+#define EXTRACT_ARRAY( d, p, c, n, t ) { d = (t *)(p + c); c += (n * sizeof( t )); }
+
+
+/*!     \brief  Free the saved state of the renderer
+ *
+ * \param pRender   pointer to the renderer state
+ */
+void
+freePlotRender( tPlotRender *pRender ) {
+    if( pRender->path )
+        cairo_path_destroy( pRender->path );
+    if( pRender->mergedPaths )
+        g_ptr_array_unref( pRender->mergedPaths );
+    memset( pRender, 0, sizeof( tPlotRender ) );
+}
+
+/*!     \brief  Copy the saved state of the renderer
+ *
+ * \param pTo       pointer to the renderer state to copy to (freed first)
+ * \param pFrom     pointer to the renderer state to copy
+ */
+void
+copyPlotRender( tPlotRender *pTo, const tPlotRender *pFrom ) {
+    freePlotRender( pTo );
+    *pTo = *pFrom;
+    pTo->path = NULL;
+    pTo->mergedPaths = NULL;            // (not copied)
+    if( pFrom->path ) {
+        // the path is held in user space .. copy it with the same transformation
+        cairo_surface_t *cs = cairo_image_surface_create( CAIRO_FORMAT_A8, 1, 1 );
+        cairo_t *cr = cairo_create( cs );
+
+        cairo_set_matrix( cr, &pFrom->matrix );
+        cairo_append_path( cr, pFrom->path );
+        pTo->path = cairo_copy_path( cr );
+        cairo_destroy( cr );
+        cairo_surface_destroy( cs );
+    }
+}
+
+#define APPEND_STATE( a, v )   g_byte_array_append( a, (const guint8 *)&(v), sizeof( v ) )
+
+/*!     \brief  Add the saved state of the renderer to a byte array
+ *
+ * Compiled HPGL drawn from renderer states with the same bytes is drawn the same.
+ * (The members are added one at a time, so there are no padding bytes.)
  *
+ * \param pState    byte array to add to
+ * \param pRender   pointer to the renderer state
+ */
+void
+appendPlotRenderState( GByteArray *pState, const tPlotRender *pRender ) {
+    const tPlotterState *pPlotter = &pRender->plotterState;
+    guint8 flags = pPlotter->flags.bHPGLscaled | pPlotter->flags.bbHPGLscaleType << 1
+            | pPlotter->flags.bHPGLscaleLBposition << 3;
+    gboolean bFromStart = pRender->HPGLserialCount == 0;    // (the state is set up when drawn)
+
+    APPEND_STATE( pState, bFromStart );
+    APPEND_STATE( pState, flags );
+    APPEND_STATE( pState, pPlotter->HPGLplotterP1P2 );
+    APPEND_STATE( pState, pPlotter->widthTransformed );
+    APPEND_STATE( pState, pPlotter->heightTransformed );
+    APPEND_STATE( pState, pPlotter->HPGLinputP1P2 );
+    APPEND_STATE( pState, pPlotter->HPGLscaledP1P2 );
+    APPEND_STATE( pState, pPlotter->HPGLscaleIsotropicOffset );
+    APPEND_STATE( pState, pPlotter->HPGLrotation );
+    APPEND_STATE( pState, pPlotter->intitalMatrix );
+    APPEND_STATE( pState, pRender->areaWidth );
+    APPEND_STATE( pState, pRender->areaHeight );
+    APPEND_STATE( pState, pRender->dot );
+    APPEND_STATE( pState, pRender->HPGLpen );
+    APPEND_STATE( pState, pRender->HPGLlineType );
+    APPEND_STATE( pState, pRender->bPenDown );
+    APPEND_STATE( pState, pRender->bFirstPoint );
+    APPEND_STATE( pState, pRender->matrix );
+    APPEND_STATE( pState, pRender->fontMatrix );
+    APPEND_STATE( pState, pRender->lineWidth );
+    if( pRender->path ) {
+        for( gint i = 0; i < pRender->path->num_data; i += pRender->path->data[ i ].header.length ) {
+            const cairo_path_data_t *pData = &pRender->path->data[ i ];
+            APPEND_STATE( pState, pData->header.type );
+            for( gint point = 1; point < pData->header.length; point++ ) {
+                APPEND_STATE( pState, pData[ point ].point.x );
+                APPEND_STATE( pState, pData[ point ].point.y );
+            }
+        }
+    }
+}
+
+/*!     \brief  Draw compiled HPGL starting where the last call left off
+ *
+ * The renderer state (plotter state, pen, line type, transformation and the path
+ * that has not been stroked yet) is saved in pRender, so that compiled HPGL added
+ * later can be drawn without drawing the plot from the start.
+ * Each call must be given a cairo context for a surface of the same size
+ * (and with the same initial transformation).
+ * With a zeroed pRender the whole plot is drawn.
+ *
+ * If pRender->bBatchPens is set, the lines are not stroked at each pen up but
+ * gathered into one path that is stroked when the pen, line type or transformation
+ * changes (or before a label). Lines of one pen may then be drawn out of order
+ * (which only matters if they overlap and are translucent), but there are far fewer
+ * strokes for plots with dense traces.
+ *
+ * If pRender->bMergePaths is set (for vector exports), the lines are batched and
+ * the lines of each batch are merged into one path for each pen and line type:
+ * lines carrying on from where the path ends are joined to it, and repeated
+ * and straight-on points are left out. Nothing is stroked; strokeMergedPaths()
+ * strokes each path once, when the plot has been drawn. The lines are then
+ * drawn after the labels and dots, a pen at a time.
+ *
+ * If pRender->lodTolerance is set, lines drawn with many points are simplified
+ * so that they are not drawn in more detail than that (see lineToLOD()).
+ * It is for the screen only; exports are drawn with every point.
+ *
+ * If pRender->pSnapshot is set, the compiled HPGL, pens and plotter sheet are
+ * taken from it and not from pGlobal (so it can be drawn on another thread).
+ *
+ * If pRender->penLayers are set (a cairo context for each pen, all for surfaces
+ * of the same size), what each pen draws goes on its own layer, in opaque black.
+ * The layers can then be composited with any pen colours (or some pens left out)
+ * without drawing the plot again. cr must then be one of the layers.
+ * pRender->penLayersUsed has a bit set for each layer drawn on.
+ *
+ * \ingroup drawing
+ *
+ * \param cr            pointer to cairo context
+ * \param imageWidth    width of the surface
+ * \param imageHeight   height of the surface
+ * \param length        draw the compiled HPGL up to here
+ * \param pRender       pointer to the renderer state (updated)
+ * \param pGlobal       pointer to global data
  */
 /*
  * Initially the display is in 'plotter units' with the LL (P1) at 0,0
@@ -293,81 +1019,113 @@ translateHPGLfontSizeToCairo( gdouble HPGLcharSizeX, gdouble HPGLcharSizeY,
  * The IN instruction will move P1 and P2 but is only relevant when the
  * SC command is used.
  */
-gboolean
-plotCompiledHPGL (cairo_t *cr, gdouble imageWidth, gdouble imageHeight, tGlobal *pGlobal)
+void
+plotCompiledHPGLfrom (cairo_t *cr, gdouble imageWidth, gdouble imageHeight, gsize length,
+        tPlotRender *pRender, tGlobal *pGlobal)
 {
-    cairo_save(cr); {
-        cairo_font_options_t *pFontOptions = cairo_font_options_create();
-        cairo_get_font_options (cr, pFontOptions);
-        cairo_font_options_set_hint_style( pFontOptions, CAIRO_HINT_STYLE_NONE );
-        cairo_font_options_set_hint_metrics( pFontOptions, CAIRO_HINT_METRICS_OFF );
-        cairo_set_font_options (cr, pFontOptions);
-        cairo_font_options_destroy( pFontOptions );
-
-        if( pGlobal->plotHPGL ) {
-            guint HPGLserialCount = 0;
+    cairo_t *crGiven = cr;      // (cr moves from layer to layer when drawing on pen layers)
+
+    cairo_save(crGiven); {
+        initHPGLfont();
+        cairo_set_font_options (cr, HPGLfontOptions);
+
+        if( length > 0 && pRender->HPGLserialCount < length ) {
+            const tPlotSnapshot *pSnapshot = pRender->pSnapshot;
+            const guchar *plotHPGL = pSnapshot ? pSnapshot->plotHPGL.data : pGlobal->plotHPGL.data;
+            const GdkRGBA *HPGLpens = pSnapshot ? pSnapshot->HPGLpens : pGlobal->HPGLpens;
+            gsize HPGLserialCount = pRender->HPGLserialCount;
             gfloat charSizeX = 1.0, charSizeY = 1.0;
-            tPlotterState plotterState = {0};
-            guint length = *((guint *)pGlobal->plotHPGL);
-            gint HPGLpen = 0;
-            gboolean bFirstPoint = FALSE;
-            gchar *pLabel;
+            tPlotterState plotterState = pRender->plotterState;
+            gint HPGLpen = pRender->HPGLpen;
+            gboolean bFirstPoint = pRender->bFirstPoint;
             tCoordFloat *pUserChar;
-            guint labelLength, nPoints;
-            gboolean bPenDown = FALSE;
+            guint nRuns, nPoints;
+            gboolean bPenDown = pRender->bPenDown;
             cairo_matrix_t matrix;
-            __attribute__((unused)) gint HPGLlineType = 0;
+            gint HPGLlineType = pRender->HPGLlineType;
+            gboolean bBatchPens = pRender->bBatchPens || pRender->bMergePaths;
 
             gdouble cairoX, cairoY;
-            gdouble areaWidth = imageWidth, areaHeight = imageHeight;
+            gdouble scaleX, offsetX, scaleY, offsetY;
+            gdouble areaWidth = pRender->areaWidth, areaHeight = pRender->areaHeight;
 
             tCoord *pPoint;
             eHPGLscalingType scaleType;
-
-            plotterState.HPGLplotterP1P2[ P1 ] = pGlobal->HPGLplotterP1P2[P1];
-            plotterState.HPGLplotterP1P2[ P2 ] = pGlobal->HPGLplotterP1P2[P2];
-            plotterState.HPGLinputP1P2[ P1 ] = plotterState.HPGLplotterP1P2[ P1 ];
-            plotterState.HPGLinputP1P2[ P2 ] = plotterState.HPGLplotterP1P2[ P2 ];
-            // The surface may have been adjusted (i.e. for printing, PDF & SVG
-            // to position correctly on a page that is not 1.414:1 aspect ratio
-            // We need to save the transformation matrix, so that is can be recovered
-            // if we get one or more rotation commands
-            cairo_get_matrix (cr, &plotterState.intitalMatrix );
-
-            // There is always a character count at the head of the data
-            HPGLserialCount += sizeof(guint);
-
-            setSurfaceRotation( cr, &plotterState, imageWidth, imageHeight,
-                    &areaWidth, &areaHeight );
-            // Use a font that is monospaced (like the HP vector plotter)
-            // Noto Sans Mono Light
-            cairo_select_font_face(cr, HPGL_FONT, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-
-            // The default character size is 0.19 cm wide by 0.27 cm high..
-            // Our A4 page is 297 wide x 210 high i.e 156.3 characters along the wide side
-            //
-            cairo_set_font_size (cr, imageWidth / 85 );
-
-            // flip Y axis
-            cairo_matrix_t font_matrix;
-            // we need to flip the font back (otherwise it will be upside down)
-            cairo_get_font_matrix( cr, &font_matrix );
-            font_matrix.yy = -font_matrix.yy ;
-            cairo_set_font_matrix( cr, &font_matrix );
-
-            // Better center the plot in the screen
-            gdouble dot = (gdouble)areaWidth / 300.0;
+            cairo_scaled_font_t *pScaledFont = NULL;   // for the current text size and rotation
+
+            cairo_set_font_face(cr, HPGLfontFace);
+
+            if( HPGLserialCount == 0 ) {
+                areaWidth = imageWidth;
+                areaHeight = imageHeight;
+                plotterState = (tPlotterState){0};
+                plotterState.HPGLplotterP1P2[ P1 ] = pSnapshot ? pSnapshot->HPGLplotterP1P2[P1] : pGlobal->HPGLplotterP1P2[P1];
+                plotterState.HPGLplotterP1P2[ P2 ] = pSnapshot ? pSnapshot->HPGLplotterP1P2[P2] : pGlobal->HPGLplotterP1P2[P2];
+                plotterState.HPGLinputP1P2[ P1 ] = plotterState.HPGLplotterP1P2[ P1 ];
+                plotterState.HPGLinputP1P2[ P2 ] = plotterState.HPGLplotterP1P2[ P2 ];
+                // The surface may have been adjusted (i.e. for printing, PDF & SVG
+                // to position correctly on a page that is not 1.414:1 aspect ratio
+                // We need to save the transformation matrix, so that is can be recovered
+                // if we get one or more rotation commands
+                cairo_get_matrix (cr, &plotterState.intitalMatrix );
+
+                setSurfaceRotation( cr, &plotterState, imageWidth, imageHeight,
+                        &areaWidth, &areaHeight );
+
+                // The default character size is 0.19 cm wide by 0.27 cm high..
+                // Our A4 page is 297 wide x 210 high i.e 156.3 characters along the wide side
+                //
+                cairo_set_font_size (cr, imageWidth / 85 );
+
+                // flip Y axis
+                cairo_matrix_t font_matrix;
+                // we need to flip the font back (otherwise it will be upside down)
+                cairo_get_font_matrix( cr, &font_matrix );
+                font_matrix.yy = -font_matrix.yy ;
+                cairo_set_font_matrix( cr, &font_matrix );
+
+                // Better center the plot in the screen
+                pRender->dot = (gdouble)areaWidth / 300.0;
+
+                // If we don't set the color its black ... but the HP8753 does
+                HPGLpen = 1;        // black pen by default
+                HPGLlineType = 0;
+                bPenDown = bFirstPoint = FALSE;
+                cairo_set_line_width( cr, areaWidth/1000.0 );
+                cairo_move_to(cr, 0, 0 );
+            } else {
+                // carry on from where we left off
+                cairo_set_matrix( cr, &pRender->matrix );
+                cairo_set_font_matrix( cr, &pRender->fontMatrix );
+                cairo_set_line_width( cr, pRender->lineWidth );
+                cairo_new_path( cr );
+                if( pRender->path )
+                    cairo_append_path( cr, pRender->path );
+            }
+
+            gdouble dot = pRender->dot;
             gdouble dashes[] = { dot * 5, dot * 2 };
 
-            // If we don't set the color its black ... but the HP8753 does
-            gdk_cairo_set_source_rgba (cr, &pGlobal->HPGLpens[1] );      // black pen by default
-            cairo_set_line_width( cr, areaWidth/1000.0 );
-            cairo_move_to(cr, 0, 0 );
+            if( pRender->penLayers[ 0 ] )
+                cr = switchPenLayer( cr, HPGLpen < NUM_HPGL_PENS ? HPGLpen : 1, pRender );
+            setPenSource( cr, HPGLpens, HPGLpen < NUM_HPGL_PENS ? HPGLpen : 1, pRender );
+            switch ( HPGLlineType ) {
+            case 0:
+            default:
+                cairo_set_dash( cr, NULL, 0, 0.0 );
+                break;
+            case 2:
+                cairo_set_dash( cr, dashes, sizeof(dashes)/sizeof(gdouble), 0.0 );
+                break;
+            case 1:
+                cairo_set_dash( cr, &dot, 1, 0.0 );
+                break;
+            }
 
             do {
                 // get compiled HPGL command byte
-                eHPGL cmd = *((guchar *)(pGlobal->plotHPGL+HPGLserialCount)) ;
-                HPGLserialCount += sizeof( eHPGL );
+                eHPGL cmd = *((guchar *)(plotHPGL+HPGLserialCount)) ;
+                HPGLserialCount += CHPGL_OPCODE_SIZE;
 
                 switch ( cmd ) {
                 case CHPGL_PEN_UP:
@@ -380,14 +1138,18 @@ plotCompiledHPGL (cairo_t *cr, gdouble imageWidth, gdouble imageHeight, tGlobal
                             cairoX = 0.0;
                             cairoY = 0.0;
                         }
-                        cairo_new_path( cr );
+                        if( bBatchPens )
+                            strokeOrMergePenBatch( cr, pRender, HPGLpen );     // the lines before the dot
+                        else
+                            cairo_new_path( cr );
 #define DOT_SIZE areaWidth/1250
                         cairo_arc( cr, cairoX, cairoY, DOT_SIZE, 0.0, 2.0 * M_PI );
                         cairo_fill( cr );
                     } else {
                         cairo_get_current_point( cr, &cairoX, &cairoY );
                     }
-                    cairo_stroke( cr );
+                    if( !bBatchPens )
+                        cairo_stroke( cr );
                     cairo_move_to( cr, cairoX, cairoY );
                     bFirstPoint = FALSE;
                     break;
@@ -400,7 +1162,7 @@ plotCompiledHPGL (cairo_t *cr, gdouble imageWidth, gdouble imageHeight, tGlobal
                 case CHPGL_RMOVE:
                     if( HPGLserialCount == 0 )
                         break;
-                    EXTRACT_ARRAY( pPoint, pGlobal->plotHPGL, HPGLserialCount, 1, tCoord );
+                    EXTRACT_ARRAY( pPoint, plotHPGL, HPGLserialCount, 1, tCoord );
                     translateHPGLpointToCairo( pPoint, areaWidth, areaHeight,
                             &cairoX, &cairoY, &plotterState, SCALE_ONLY );
 
@@ -419,7 +1181,7 @@ plotCompiledHPGL (cairo_t *cr, gdouble imageWidth, gdouble imageHeight, tGlobal
                     break;
 
                 case CHPGL_MOVE:
-                    EXTRACT_ARRAY( pPoint, pGlobal->plotHPGL, HPGLserialCount, 1, tCoord );
+                    EXTRACT_ARRAY( pPoint, plotHPGL, HPGLserialCount, 1, tCoord );
                     translateHPGLpointToCairo( pPoint, areaWidth, areaHeight,
                             &cairoX, &cairoY, &plotterState, SCALEandTRANSLATE );
                     if( bPenDown ) {
@@ -430,16 +1192,83 @@ plotCompiledHPGL (cairo_t *cr, gdouble imageWidth, gdouble imageHeight, tGlobal
                     }
                     break;
 
+                case CHPGL_POLYLINE:
+                case CHPGL_RPOLYLINE:
+                    EXTRACT( nPoints, plotHPGL, HPGLserialCount, guint16 );
+                    getHPGLtoCairoTransform( areaWidth, areaHeight, &scaleX, &offsetX, &scaleY, &offsetY,
+                            &plotterState, cmd == CHPGL_RPOLYLINE ? SCALE_ONLY : SCALEandTRANSLATE );
+                    if( bPenDown )
+                        bFirstPoint = FALSE;
+
+                    if( cmd == CHPGL_RPOLYLINE && !cairo_has_current_point( cr ) && nPoints > 0 ) {
+                        // the first relative point is from the origin
+                        tCoord point;
+                        EXTRACT( point, plotHPGL, HPGLserialCount, tCoord );
+                        if( bPenDown )
+                            cairo_line_to( cr, point.x * scaleX + offsetX, point.y * scaleY + offsetY );
+                        else
+                            cairo_move_to( cr, point.x * scaleX + offsetX, point.y * scaleY + offsetY );
+                        nPoints--;
+                    }
+
+                    if( bPenDown && pRender->lodTolerance > 0.0 ) {
+                        // simplify the line to the resolution of the screen
+                        tLODcolumn lod = { .tolerance = pRender->lodTolerance };
+
+                        if( cmd == CHPGL_RPOLYLINE )
+                            cairo_get_current_point( cr, &cairoX, &cairoY );
+                        for( ; nPoints > 0; nPoints-- ) {
+                            tCoord point;
+                            EXTRACT( point, plotHPGL, HPGLserialCount, tCoord );
+                            if( cmd == CHPGL_POLYLINE ) {
+                                cairoX = point.x * scaleX + offsetX;
+                                cairoY = point.y * scaleY + offsetY;
+                            } else {
+                                cairoX += point.x * scaleX + offsetX;
+                                cairoY += point.y * scaleY + offsetY;
+                            }
+                            lineToLOD( cr, &lod, cairoX, cairoY );
+                        }
+                        flushLODcolumn( cr, &lod );
+                    }
+
+                    for( ; nPoints > 0; nPoints-- ) {
+                        tCoord point;
+                        EXTRACT( point, plotHPGL, HPGLserialCount, tCoord );
+                        cairoX = point.x * scaleX + offsetX;
+                        cairoY = point.y * scaleY + offsetY;
+                        if( cmd == CHPGL_POLYLINE ) {
+                            if( bPenDown )
+                                cairo_line_to( cr, cairoX, cairoY );
+                            else
+                                cairo_move_to( cr, cairoX, cairoY );
+                        } else {
+                            if( bPenDown )
+                                cairo_rel_line_to( cr, cairoX, cairoY );
+                            else
+                                cairo_rel_move_to( cr, cairoX, cairoY );
+                        }
+                    }
+                    break;
+
                 case CHPGL_PEN:
-                    if( bPenDown ) {
+                    if( bBatchPens ) {
+                        strokePenBatch( cr, pRender, HPGLpen );
+                    } else if( bPenDown ) {
                         cairo_stroke_preserve( cr );
                     }
-                    EXTRACT( HPGLpen, pGlobal->plotHPGL, HPGLserialCount, guint8 );
-                    gdk_cairo_set_source_rgba (cr, &pGlobal->HPGLpens[ HPGLpen < NUM_HPGL_PENS ? HPGLpen : 1 ] );
+                    EXTRACT( HPGLpen, plotHPGL, HPGLserialCount, guint8 );
+                    if( pRender->penLayers[ 0 ] ) {
+                        cr = switchPenLayer( cr, HPGLpen < NUM_HPGL_PENS ? HPGLpen : 1, pRender );
+                        g_clear_pointer( &pScaledFont, cairo_scaled_font_destroy );
+                    }
+                    setPenSource( cr, HPGLpens, HPGLpen < NUM_HPGL_PENS ? HPGLpen : 1, pRender );
                     break;
 
                 case CHPGL_LINETYPE:
-                    EXTRACT( HPGLlineType, pGlobal->plotHPGL, HPGLserialCount, guint8 );
+                    if( bBatchPens )
+                        strokePenBatch( cr, pRender, HPGLpen );
+                    EXTRACT( HPGLlineType, plotHPGL, HPGLserialCount, guint8 );
                     switch ( HPGLlineType ) {
                     case 0:
                     default:
@@ -455,34 +1284,42 @@ plotCompiledHPGL (cairo_t *cr, gdouble imageWidth, gdouble imageHeight, tGlobal
                     break;
 
                     case CHPGL_LABEL:
-                        EXTRACT( labelLength, pGlobal->plotHPGL, HPGLserialCount, guint16 );
-                        // label is null terminated
-                        EXTRACT_ARRAY( pLabel, pGlobal->plotHPGL, HPGLserialCount, labelLength+1, gchar );
-                        showLabel( cr, pLabel);
-                        // display the label
+                        if( bBatchPens )
+                            strokePenBatch( cr, pRender, HPGLpen );
+                        if( pScaledFont == NULL ) {
+                            pScaledFont = getScaledFont( cr );
+                            cairo_set_scaled_font( cr, pScaledFont );
+                        }
+                        EXTRACT( nRuns, plotHPGL, HPGLserialCount, guint16 );
+                        HPGLserialCount = showLabel( cr, pScaledFont, plotHPGL + HPGLserialCount, nRuns ) - plotHPGL;
                         break;
 
                     case CHPGL_UCHAR:
-                        EXTRACT( nPoints, pGlobal->plotHPGL, HPGLserialCount, guint16 );
-                        EXTRACT_ARRAY( pUserChar, pGlobal->plotHPGL, HPGLserialCount, nPoints, tCoordFloat );
+                        if( bBatchPens )
+                            strokePenBatch( cr, pRender, HPGLpen );
+                        EXTRACT( nPoints, plotHPGL, HPGLserialCount, guint16 );
+                        EXTRACT_ARRAY( pUserChar, plotHPGL, HPGLserialCount, nPoints, tCoordFloat );
                         showUserChar( cr, pUserChar, nPoints );
                         break;
 
                     case CHPGL_TEXT_SIZE:
                         cairo_matrix_init_identity( &matrix );
-                        EXTRACT( charSizeX, pGlobal->plotHPGL, HPGLserialCount, gfloat );
-                        EXTRACT( charSizeY, pGlobal->plotHPGL, HPGLserialCount, gfloat );
+                        EXTRACT( charSizeX, plotHPGL, HPGLserialCount, gfloat );
+                        EXTRACT( charSizeY, plotHPGL, HPGLserialCount, gfloat );
                         translateHPGLfontSizeToCairo( charSizeX, charSizeY, areaWidth, areaHeight,
                                 &cairoX, &cairoY, &plotterState );
                         matrix.xx = cairoX;
                         matrix.yy = cairoY;
                         // matrix.y0 = -matrix.yy * 0.15;
                         cairo_set_font_matrix (cr, &matrix);
+                        g_clear_pointer( &pScaledFont, cairo_scaled_font_destroy );
                         break;
 
                     case CHPGL_OP:
-                        EXTRACT( plotterState.HPGLplotterP1P2[ P1 ], pGlobal->plotHPGL, HPGLserialCount, tCoord );
-                        EXTRACT( plotterState.HPGLplotterP1P2[ P2 ], pGlobal->plotHPGL, HPGLserialCount, tCoord );
+                        if( bBatchPens )
+                            strokePenBatch( cr, pRender, HPGLpen );
+                        EXTRACT( plotterState.HPGLplotterP1P2[ P1 ], plotHPGL, HPGLserialCount, tCoord );
+                        EXTRACT( plotterState.HPGLplotterP1P2[ P2 ], plotHPGL, HPGLserialCount, tCoord );
 
                         // Remove scaling and rotation
                         plotterState.HPGLrotation = 0;
@@ -491,69 +1328,111 @@ plotCompiledHPGL (cairo_t *cr, gdouble imageWidth, gdouble imageHeight, tGlobal
                         plotterState.HPGLinputP1P2[ P2 ] = plotterState.HPGLplotterP1P2[ P2 ];
                         setSurfaceRotation( cr, &plotterState, imageWidth, imageHeight,
                                 &areaWidth, &areaHeight );
+                        g_clear_pointer( &pScaledFont, cairo_scaled_font_destroy );
                         break;
 
                     case CHPGL_IP:
-                        EXTRACT( plotterState.HPGLinputP1P2[ P1 ], pGlobal->plotHPGL, HPGLserialCount, tCoord );
-                        EXTRACT( plotterState.HPGLinputP1P2[ P2 ], pGlobal->plotHPGL, HPGLserialCount, tCoord );
+                        EXTRACT( plotterState.HPGLinputP1P2[ P1 ], plotHPGL, HPGLserialCount, tCoord );
+                        EXTRACT( plotterState.HPGLinputP1P2[ P2 ], plotHPGL, HPGLserialCount, tCoord );
                         break;
 
                     case CHPGL_SCALING:
-                        EXTRACT( scaleType, pGlobal->plotHPGL, HPGLserialCount, eHPGLscalingType );
+                        EXTRACT( scaleType, plotHPGL, HPGLserialCount, eHPGLscalingType );
                         if( scaleType == SCALING_NONE ) {
                             plotterState.flags.bHPGLscaled = 0;
                         } else {
                             plotterState.flags.bHPGLscaled = 1;
                             plotterState.flags.bbHPGLscaleType = scaleType;
-                            plotterState.HPGLscaledP1P2[ P1 ] = *(tCoord *)(pGlobal->plotHPGL + HPGLserialCount);
-                            HPGLserialCount += sizeof( tCoord );
-                            plotterState.HPGLscaledP1P2[ P2 ] = *(tCoord *)(pGlobal->plotHPGL + HPGLserialCount);
-                            HPGLserialCount += sizeof( tCoord );
-                            if( scaleType == SCALING_ISOTROLIC_LB ) {
-                                plotterState.HPGLscaleIsotropicOffset = *(tCoord *)(pGlobal->plotHPGL + HPGLserialCount);
-                                HPGLserialCount += sizeof( tCoord );
-                            }
+                            EXTRACT( plotterState.HPGLscaledP1P2[ P1 ], plotHPGL, HPGLserialCount, tCoord );
+                            EXTRACT( plotterState.HPGLscaledP1P2[ P2 ], plotHPGL, HPGLserialCount, tCoord );
+                            if( scaleType == SCALING_ISOTROLIC_LB )
+                                EXTRACT( plotterState.HPGLscaleIsotropicOffset, plotHPGL, HPGLserialCount, tCoord );
                         }
                         break;
 
                     case CHPGL_ROTATION:
-                        EXTRACT( plotterState.HPGLrotation, pGlobal->plotHPGL, HPGLserialCount, gint );
+                        if( bBatchPens )
+                            strokePenBatch( cr, pRender, HPGLpen );
+                        EXTRACT( plotterState.HPGLrotation, plotHPGL, HPGLserialCount, gint );
                         setSurfaceRotation( cr, &plotterState, imageWidth, imageHeight,
                                 &areaWidth, &areaHeight );
+                        g_clear_pointer( &pScaledFont, cairo_scaled_font_destroy );
                         break;
 
                     default:
                         break;
                 }
             } while (HPGLserialCount < length);
-        } else {
+
+            if( bBatchPens )
+                strokePenBatch( cr, pRender, HPGLpen );
+            g_clear_pointer( &pScaledFont, cairo_scaled_font_destroy );
+
+            // save where we are, for the compiled HPGL yet to come
+            pRender->HPGLserialCount = HPGLserialCount;
+            pRender->plotterState = plotterState;
+            pRender->areaWidth = areaWidth;
+            pRender->areaHeight = areaHeight;
+            pRender->HPGLpen = HPGLpen;
+            pRender->HPGLlineType = HPGLlineType;
+            pRender->bPenDown = bPenDown;
+            pRender->bFirstPoint = bFirstPoint;
+            cairo_get_matrix( cr, &pRender->matrix );
+            cairo_get_font_matrix( cr, &pRender->fontMatrix );
+            pRender->lineWidth = cairo_get_line_width( cr );
+            if( pRender->path )
+                cairo_path_destroy( pRender->path );
+            pRender->path = cairo_copy_path( cr );
+        } else if( length == 0 ) {
             drawHPlogo ( cr, imageWidth / 2.0, imageHeight * 0.8, imageWidth / 1000.0 );
         }
-    } cairo_restore( cr );
-    return TRUE;
+    } cairo_restore( crGiven );
 }
 
-/*!     \brief  Signal received to draw the first drawing area
+/*!     \brief  Take a copy of the plot (to draw away from the main loop)
  *
- * Draw the plot for area A
+ * Only whole commands are copied (the GPIB thread may be adding to the plot).
  *
- * \param widget        pointer to GtkDrawingArea widget
- * \param cr            pointer to cairo structure
- * \param areaWidth     width
- * \param areaHeight    height
- * \param pGlobal       pointer to the global data structure
+ * \param pSnapshot     pointer to the snapshot (free with freeCompiledHPGL( &pSnapshot->plotHPGL ))
+ * \param pGlobal       pointer to global data
  */
 void
-CB_DrawingArea_Draw (GtkDrawingArea *widget, cairo_t *cr,
-        gint areaWidth, gint areaHeight, gpointer gpGlobal)
-{
-    tGlobal *pGlobal = (tGlobal *)gpGlobal;
-    // clear the screen
-    if( pGlobal->flags.bAutoClear || pGlobal->plotHPGL == NULL) {
-        cairo_set_source_rgba (cr, 1.0, 1.0, 1.0, 1.0 );
-        cairo_paint( cr );
+takePlotSnapshot( tPlotSnapshot *pSnapshot, tGlobal *pGlobal ) {
+    gsize length;
+
+    *pSnapshot = (tPlotSnapshot){0};
+    // the GPIB thread may not move the plot while it is copied
+    lockCompiledHPGL( &pGlobal->plotHPGL );
+    length = pGlobal->plotHPGL.complete;
+    if( length > 0 ) {
+        memcpy( reserveCompiledHPGL( &pSnapshot->plotHPGL, length ), pGlobal->plotHPGL.data, length );
+        pSnapshot->plotHPGL.length = pSnapshot->plotHPGL.complete = length;
     }
-
-    plotCompiledHPGL ( cr, areaWidth, areaHeight, pGlobal);
+    unlockCompiledHPGL( &pGlobal->plotHPGL );
+    memcpy( pSnapshot->HPGLpens, pGlobal->HPGLpens, sizeof( pSnapshot->HPGLpens ) );
+    memcpy( pSnapshot->HPGLplotterP1P2, pGlobal->HPGLplotterP1P2, sizeof( pSnapshot->HPGLplotterP1P2 ) );
 }
 
+/*!     \brief  Draw the compiled HPGL
+ *
+ * \ingroup drawing
+ *
+ * \param cr            pointer to cairo context
+ * \param imageWidth    width of the surface
+ * \param imageHeight   height of the surface
+ * \param pGlobal       pointer to global data
+ * \return              TRUE
+ */
+gboolean
+plotCompiledHPGL (cairo_t *cr, gdouble imageWidth, gdouble imageHeight, tGlobal *pGlobal)
+{
+    tPlotSnapshot snapshot;
+    tPlotRender render = { .pSnapshot = &snapshot };
+
+    // the GPIB thread may be adding to the plot .. draw a copy of it
+    takePlotSnapshot( &snapshot, pGlobal );
+    plotCompiledHPGLfrom( cr, imageWidth, imageHeight, snapshot.plotHPGL.length, &render, pGlobal );
+    freePlotRender( &render );
+    freeCompiledHPGL( &snapshot.plotHPGL );
+    return TRUE;
+}
@@ -563,9 +563,6 @@ sendGPIBreply( gchar *sHPGLreply, tGlobal *pGlobal ) {
     gint GPIBstatus;
     gboolean bWaitingForTalker = TRUE;
 
-    if( pGlobal->flags.bMuteGPIBreply )
-        return TRUE;
-
     while ( bWaitingForTalker ) {
         GPIBstatus = 0;
 
@@ -637,7 +634,7 @@ sendGPIBreply( gchar *sHPGLreply, tGlobal *pGlobal ) {
         gboolean bDCAS = FALSE;
 
 #define MAX_HPGL_PLOT_CHUNK    2000
-        gchar sHPGL[ MAX_HPGL_PLOT_CHUNK + 1 ] = "";
+        gchar sHPGL[ MAX_HPGL_PLOT_CHUNK ];     // not null terminated
 
         gulong __attribute__((unused)) datum = 0;
         glong  nBytesRead;
@@ -682,6 +679,16 @@ sendGPIBreply( gchar *sHPGLreply, tGlobal *pGlobal ) {
                     closeGPIBcontroller( pGlobal );
                     postMessageToMainLoop(TM_OFFLINE, NULL);
                     break;
+                case TG_ADD_PLOT: {
+                    // compiled on the main loop (i.e. a recalled file) .. this thread is the only writer of the plot
+                    tPlotAddition *pAddition = message->data;
+
+                    if( pAddition->bClear )
+                        clearCompiledHPGL( &pGlobal->plotHPGL );
+                    appendCompiledHPGL( &pGlobal->plotHPGL, &pAddition->plotHPGL );
+                    postMessageToMainLoop(TM_REFRESH_PLOT, NULL);
+                    }
+                    break;
                 case TG_REINITIALIZE_GPIB:
                     if( openGPIBcontroller( pGlobal, TRUE ) == ERROR ) {
                         postError("GPIB controller no connection");
@@ -764,8 +771,12 @@ sendGPIBreply( gchar *sHPGLreply, tGlobal *pGlobal ) {
                     MAX_HPGL_PLOT_CHUNK,  &nBytesRead,
                     &GPIBstatus, TIMEOUT_NONE);
             // If we were interrupted by a message... it's not an error.. see what the message is
-            if( readResult == eRDWT_ABORT )
+            // (after compiling what had been read .. the message may add a recalled plot during a capture)
+            if( readResult == eRDWT_ABORT ) {
+                if( nBytesRead > 0 )
+                    deserializeHPGL_n( sHPGL, nBytesRead, pGlobal );
                 continue;
+            }
 
             if( readResult != eRDWT_OK ) {
                 if( readResult == eRDWT_CLEAR )
@@ -773,12 +784,9 @@ sendGPIBreply( gchar *sHPGLreply, tGlobal *pGlobal ) {
                 else
                     LOG( G_LOG_LEVEL_WARNING, "ibrd error: %s / status: 0x%04x", gpib_error_string(ThreadIberr()), ThreadIbsta());
 
-                sHPGL[0] = 0;
                 continue;
             }
 
-            sHPGL[ nBytesRead ] = 0;	// Null terminate
-
             if( pGlobal->flags.bbDebug == 6 ) {
                 g_printerr( "%.*s", (gint)nBytesRead, sHPGL );
             }
@@ -790,7 +798,7 @@ sendGPIBreply( gchar *sHPGLreply, tGlobal *pGlobal ) {
                 pGlobal->refreshTimer = 0;
             }
 
-            if( deserializeHPGL( sHPGL, pGlobal ) == TRUE ) {
+            if( deserializeHPGL_n( sHPGL, nBytesRead, pGlobal ) == TRUE ) {
                 postMessageToMainLoop(TM_REFRESH_PLOT, NULL);
             } else {
                 pGlobal->refreshTimer = g_timeout_add( 250, (GSourceFunc)postRefreshOnTimeout, pGlobal );
@@ -55,11 +55,33 @@ CB_chk_AutoErase ( GtkCheckButton* wBtnAutoErase, gpointer user_data ) {
     pGlobal->flags.bAutoClear = gtk_check_button_get_active( wBtnAutoErase );
 }
 
+/*!     \brief  Have the GPIB thread add compiled HPGL to the plot (or empty it)
+ *
+ * The GPIB thread is the only writer of the compiled plot (see lockCompiledHPGL()),
+ * so HPGL compiled on the main loop is handed to it. It refreshes the plot when
+ * it has been added.
+ *
+ * \param pCompiledHPGL : compiled HPGL to add (taken over and emptied) or NULL
+ * \param bClear        : empty the plot first
+ */
+static void
+addToPlotOnGPIBthread( tCompiledHPGL *pCompiledHPGL, gboolean bClear ) {
+    tPlotAddition *pAddition = g_new0( tPlotAddition, 1 );
+
+    if( pCompiledHPGL ) {
+        pAddition->plotHPGL = *pCompiledHPGL;
+        *pCompiledHPGL = (tCompiledHPGL){0};
+    }
+    pAddition->bClear = bClear;
+    postDataToGPIBThread( TG_ADD_PLOT, pAddition );
+}
+
 void
 CB_btn_Erase ( GtkButton* wBtnErase, gpointer user_data ) {
     tGlobal *pGlobal = (tGlobal *)g_object_get_data(G_OBJECT( wBtnErase ), "data");
-    clearHPGL( pGlobal );
-    gtk_widget_queue_draw ( WLOOKUP ( pGlobal, "drawing_Plot") );
+    clearVerbatimHPGL( pGlobal );
+    addToPlotOnGPIBthread( NULL, TRUE );
+    invalidatePlotCache( pGlobal );
 }
 
 void
@@ -173,29 +195,33 @@ CB_btn_SaveHPGL ( GtkButton* wBtnSaveHPGL, gpointer user_data ) {
 // Call back when open/recall file is selected
 void
 HPGLopenFile( GFile *file, gboolean bCommandLineFile, tGlobal *pGlobal ) {
-    FILE *fHPGL = NULL;
+    GMappedFile *mappedHPGL;
     GtkAlertDialog *alert_dialog;
 
     gchar *sChosenFilename = g_file_get_path( file );
 
-#define TBUF_SIZE   10000
-    if( (fHPGL = fopen( sChosenFilename, "r" )) != NULL ) {
-        gchar tbuf[ TBUF_SIZE+1 ];
-        gint n = 0;
-
-        pGlobal->flags.bMuteGPIBreply = TRUE;
+    // The file is mapped into memory and parsed in place (no copies)
+    if( (mappedHPGL = g_mapped_file_new( sChosenFilename, FALSE, NULL )) != NULL ) {
+        const gchar *sHPGL = g_mapped_file_get_contents( mappedHPGL );
+        gsize HPGLlength = g_mapped_file_get_length( mappedHPGL );
+        tCompiledHPGL plotHPGL = {0};
+        // The file has its own parser (and compiled plot) so that it does not
+        // disturb (or reply to) any plot being received from the instrument
+        tHPGLParser *pParser = newHPGLparser( &plotHPGL, FALSE, pGlobal );
 
         if( pGlobal->flags.bAutoClear )
-            clearHPGL( pGlobal );
-
-        do {
-            n = fread( tbuf, sizeof( gchar ), TBUF_SIZE, fHPGL);
-            tbuf[ n ] = 0;  // null terminate
-            deserializeHPGL( tbuf, pGlobal );
-        } while ( n == TBUF_SIZE );
-        postMessageToMainLoop(TM_REFRESH_PLOT, NULL);
-        pGlobal->flags.bMuteGPIBreply = FALSE;
-        fclose( fHPGL );
+            clearVerbatimHPGL( pGlobal );
+        if( pGlobal->verbatimHPGLplot == NULL )
+            pGlobal->verbatimHPGLplot = g_string_new( NULL );
+
+        g_string_append_len( pGlobal->verbatimHPGLplot, sHPGL, HPGLlength );
+        // large files are compiled in pieces on several threads
+        parseHPGLstreamParallel( pParser, sHPGL, HPGLlength );
+        freeHPGLparser( pParser );
+        g_mapped_file_unref( mappedHPGL );
+        // the GPIB thread adds it to the plot (it may be adding HPGL from the instrument)
+        addToPlotOnGPIBthread( &plotHPGL, pGlobal->flags.bAutoClear );
+        gtk_widget_set_sensitive( WLOOKUP( pGlobal, "btn_SaveHPGL" ), pGlobal->verbatimHPGLplot->len > 0 );
 
         GFile *dir = g_file_get_parent( file );
         gchar *sChosenDirectory = g_file_get_path( dir );
@@ -277,10 +303,14 @@ CB_btn_DbgPlot ( GtkButton* wBtnDbgPlot, gpointer user_data ) {
     gtk_text_buffer_get_end_iter( wTextBuffer, &iterEnd );
     gchar *sHPGL = gtk_text_buffer_get_text ( wTextBuffer, &iterStart, &iterEnd, FALSE );
 
-    g_free( pGlobal->plotHPGL );
-    pGlobal->plotHPGL = NULL;
-    deserializeHPGL( sHPGL, pGlobal );
-    gtk_widget_queue_draw ( WLOOKUP ( pGlobal, "drawing_Plot") );
+    // Replot the (edited) HPGL from the debug window with a parser (and compiled plot) of its own
+    tCompiledHPGL plotHPGL = {0};
+    tHPGLParser *pParser = newHPGLparser( &plotHPGL, FALSE, pGlobal );
+    parseHPGLstream( pParser, sHPGL, strlen( sHPGL ) );
+    freeHPGLparser( pParser );
+    // .. which replaces the plot (on the GPIB thread)
+    addToPlotOnGPIBthread( &plotHPGL, TRUE );
+    invalidatePlotCache( pGlobal );
 
     g_free( sHPGL );
 }
@@ -57,12 +57,21 @@ initializeOptionsDialog( tGlobal *pGlobal ) {
         gtk_color_chooser_set_use_alpha( GTK_COLOR_CHOOSER( wColorButton ), TRUE );
         gtk_color_chooser_set_rgba( GTK_COLOR_CHOOSER(wColorButton), &pGlobal->HPGLpens[ pen ] );
 #pragma GCC diagnostic pop
+        gchar *sShowId = g_strdup_printf( "%d_chk_PenShow", pen );
+        gtk_check_button_set_active( WLOOKUP( pGlobal, sShowId ), !(pGlobal->hiddenPens & (1 << pen)) );
+        g_free( sShowId );
     }
 
     gchar *sOId = g_strdup_printf( "%d_chk_PaperSize", pGlobal->PDFpaperSize+1 );
     gtk_check_button_set_active( WLOOKUP( pGlobal, sOId ), TRUE );
     g_free( sOId );
 
+    gchar *sPNGId = g_strdup_printf( "%d_chk_PNGformat", pGlobal->PNGformat+1 );
+    gtk_check_button_set_active( WLOOKUP( pGlobal, sPNGId ), TRUE );
+    g_free( sPNGId );
+    gtk_spin_button_set_value( WLOOKUP( pGlobal, "spin_PNGcompression" ), pGlobal->PNGcompression );
+    gtk_spin_button_set_value( WLOOKUP( pGlobal, "spin_PNGsize" ), pGlobal->PNGsize );
+
     gchar *sPID = g_strdup_printf( "GPIB %d", pGlobal->GPIBdevicePID );
     gtk_label_set_label( WLOOKUP( pGlobal, "label_PID" ), sPID );
     g_free( sPID );
@@ -74,7 +83,7 @@ CB_btn_OK ( GtkButton* wBtnOK, gpointer user_data ) {
     tGlobal *pGlobal = (tGlobal *)g_object_get_data(G_OBJECT(wBtnOK), "data");
 
     gboolean bPreviousGPIB_InitialListener = pGlobal->flags.bGPIB_InitialListener;
-    //note: Pen colors and PDF/SVF page sizes are collected when they change
+    //note: Pen colors, PDF/SVF page sizes and PNG formats are collected when they change
 
 
     gdouble GPIBcontrollerIndex = gtk_spin_button_get_value( WLOOKUP( pGlobal, "spin_ControllerIndex") );
@@ -105,6 +114,8 @@ CB_btn_OK ( GtkButton* wBtnOK, gpointer user_data ) {
     g_free( sPID );
 
     pGlobal->HPGLperiodEnd = gtk_spin_button_get_value( WLOOKUP( pGlobal, "spin_EndOfPlotPeriod" )  );
+    pGlobal->PNGcompression = gtk_spin_button_get_value( WLOOKUP( pGlobal, "spin_PNGcompression" )  );
+    pGlobal->PNGsize = gtk_spin_button_get_value( WLOOKUP( pGlobal, "spin_PNGsize" )  );
 
     if( (bGPIBchanged || bPreviousGPIB_InitialListener != pGlobal->flags.bGPIB_InitialListener)
             && pGlobal->flags.bOnline ) {
@@ -129,7 +140,7 @@ CB_color_Pen( GtkColorButton* wColorBtn, gpointer not_used ){
     if( sequence >= 0 && sequence < NUM_HPGL_PENS-1 )
         pGlobal->HPGLpens[ sequence + 1 ] = penColor;
 
-
+    // the render thread only composites its pen layers again with the new colour
     gtk_widget_queue_draw ( WLOOKUP ( pGlobal, "drawing_Plot") );
 }
 
@@ -151,6 +162,22 @@ CB_btn_ColorReset ( GtkButton* wBtnColorReset, gpointer user_data ) {
     gtk_widget_queue_draw ( WLOOKUP ( pGlobal, "drawing_Plot") );
 }
 
+void
+CB_chk_PenShow ( GtkCheckButton* wBtnPenShow, gpointer user_data ) {
+    tGlobal *pGlobal = (tGlobal *)g_object_get_data(G_OBJECT(wBtnPenShow), "data");
+    gint sequence = (intptr_t)g_object_get_data(G_OBJECT(wBtnPenShow), "sequence");
+
+    if( sequence < 0 || sequence >= NUM_HPGL_PENS-1 )
+        return;
+
+    if( gtk_check_button_get_active( wBtnPenShow ) )
+        pGlobal->hiddenPens &= ~(1 << (sequence + 1));
+    else
+        pGlobal->hiddenPens |= 1 << (sequence + 1);
+
+    gtk_widget_queue_draw ( WLOOKUP ( pGlobal, "drawing_Plot") );
+}
+
 void
 CB_chk_PaperSize ( GtkCheckButton* wBtnPaperSize, gpointer user_data ) {
     tGlobal *pGlobal = (tGlobal *)g_object_get_data(G_OBJECT(wBtnPaperSize), "data");
@@ -161,3 +188,12 @@ CB_chk_PaperSize ( GtkCheckButton* wBtnPaperSize, gpointer user_data ) {
     }
 }
 
+void
+CB_chk_PNGformat ( GtkCheckButton* wBtnPNGformat, gpointer user_data ) {
+    tGlobal *pGlobal = (tGlobal *)g_object_get_data(G_OBJECT(wBtnPNGformat), "data");
+    gint sequence = (intptr_t)g_object_get_data(G_OBJECT(wBtnPNGformat), "sequence");
+
+    if( gtk_check_button_get_active( wBtnPNGformat ) ) {
+        pGlobal->PNGformat = sequence;
+    }
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2024 Michael G. Katzmann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file HPGLbench.c
+ *  \brief Benchmark of the HPGL parser and renderer (make bench)
+ *
+ * Compile each HPGL file (serially and in parallel pieces) and render the
+ * compiled plot to cairo image surfaces of several sizes, repeating each pass
+ * a number of times. There is no GUI and no GPIB; the same parseHPGL.c and
+ * CairoPlot.c as the plotter are used.
+ *
+ * HPGLbench [-n iterations] file.hpgl ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib-2.0/glib.h>
+#include <gtk/gtk.h>
+#include <cairo/cairo.h>
+#include "messageEvent.h"
+#include "HPGLplotter.h"
+
+#define DEFAULT_ITERATIONS  20
+
+// Image sizes rendered (A-series aspect ratio, landscape)
+static const struct {
+    gint width, height;
+} benchImageSizes[] = {
+        {  640,  453 },
+        { 1280,  905 },
+        { 2560, 1810 },
+        { 4960, 3508 }
+};
+
+tGlobal globalData = {0};
+
+// There is no main loop or instrument .. messages and replies go nowhere
+void
+postMessageToMainLoop( enum _threadmessage Command, gchar *sMessage ) {
+}
+
+gboolean
+sendGPIBreply( gchar *sHPGLreply, tGlobal *pGlobal ) {
+    return TRUE;
+}
+
+/*!     \brief  Compile HPGL repeatedly and report the throughput
+ *
+ * \param pGlobal    : pointer to global data (the compiled plot is left in plotHPGL)
+ * \param sHPGL      : pointer to the HPGL
+ * \param length     : number of characters of HPGL
+ * \param iterations : number of times to compile the HPGL
+ * \param bParallel  : compile in parallel pieces (as a recalled file)
+ */
+static void
+benchCompile( tGlobal *pGlobal, const gchar *sHPGL, gsize length, gint iterations, gboolean bParallel ) {
+    tHPGLParser *pParser = newHPGLparser( &pGlobal->plotHPGL, FALSE, pGlobal );
+    guint64 nHPGLcommands = 0;
+    gdouble seconds;
+    GTimer *timer = g_timer_new();
+
+    for( gint i = 0; i < iterations; i++ ) {
+        clearCompiledHPGL( &pGlobal->plotHPGL );
+        resetHPGLparser( pParser );
+        pParser->nHPGLcommands = 0;
+        if( bParallel )
+            parseHPGLstreamParallel( pParser, sHPGL, length );
+        else
+            parseHPGLstream( pParser, sHPGL, length );
+    }
+    seconds = g_timer_elapsed( timer, NULL );
+    nHPGLcommands = pParser->nHPGLcommands;
+
+    if( bParallel ) {
+        // the pieces are parsed by their own parsers, so the commands are not counted
+        printf( "  compile (parallel) %9.1f MB/s\n",
+                length * iterations / seconds / 1.0e6 );
+    } else {
+        printf( "  compile (serial)   %9.1f MB/s %9.1f ns/cmd  %8" G_GUINT64_FORMAT " commands"
+                "  %5.2f compiled bytes/input byte\n",
+                length * iterations / seconds / 1.0e6,
+                nHPGLcommands ? seconds * 1.0e9 / ((gdouble)nHPGLcommands * iterations) : 0.0,
+                nHPGLcommands, (gdouble)pGlobal->plotHPGL.length / length );
+    }
+
+    g_timer_destroy( timer );
+    freeHPGLparser( pParser );
+}
+
+/*!     \brief  Render the compiled plot repeatedly and return the time per frame
+ *
+ * \param pGlobal    : pointer to global data (holding the compiled plot)
+ * \param cs         : image surface to render to
+ * \param iterations : number of frames to render
+ * \param bBatchPens : stroke the lines of each pen together (as the screen does)
+ * \return milliseconds per frame
+ */
+static gdouble
+benchRenderFrames( tGlobal *pGlobal, cairo_surface_t *cs, gint iterations, gboolean bBatchPens ) {
+    gint width = cairo_image_surface_get_width( cs ), height = cairo_image_surface_get_height( cs );
+    cairo_t *cr = cairo_create( cs );
+    GTimer *timer = g_timer_new();
+    gdouble msPerFrame;
+
+    for( gint i = 0; i < iterations; i++ ) {
+        tPlotRender render = { .bBatchPens = bBatchPens };
+
+        cairo_set_source_rgba( cr, 1.0, 1.0, 1.0, 1.0 );
+        cairo_paint( cr );
+        plotCompiledHPGLfrom( cr, width, height, pGlobal->plotHPGL.length, &render, pGlobal );
+        freePlotRender( &render );
+        cairo_surface_flush( cs );
+    }
+    msPerFrame = g_timer_elapsed( timer, NULL ) * 1.0e3 / iterations;
+
+    g_timer_destroy( timer );
+    cairo_destroy( cr );
+    return msPerFrame;
+}
+
+/*!     \brief  Render the compiled plot repeatedly and report the time per frame
+ *
+ * \param pGlobal    : pointer to global data (holding the compiled plot)
+ * \param iterations : number of frames to render for each image size
+ */
+static void
+benchRender( tGlobal *pGlobal, gint iterations ) {
+    for( gint size = 0; size < G_N_ELEMENTS( benchImageSizes ); size++ ) {
+        gint width = benchImageSizes[ size ].width, height = benchImageSizes[ size ].height;
+        cairo_surface_t *cs = cairo_image_surface_create( CAIRO_FORMAT_ARGB32, width, height );
+
+        printf( "  render %4d x %-4d %9.2f ms/frame %9.2f ms/frame (pens batched)\n", width, height,
+                benchRenderFrames( pGlobal, cs, iterations, FALSE ),
+                benchRenderFrames( pGlobal, cs, iterations, TRUE ) );
+
+        cairo_surface_destroy( cs );
+    }
+}
+
+int
+main( int argc, char *argv[] ) {
+    tGlobal *pGlobal = &globalData;
+    gint iterations = DEFAULT_ITERATIONS;
+    gint iArg = 1;
+
+    if( iArg + 1 < argc && g_strcmp0( argv[ iArg ], "-n" ) == 0 ) {
+        iterations = MAX( atoi( argv[ iArg + 1 ] ), 1 );
+        iArg += 2;
+    }
+    if( iArg >= argc ) {
+        fprintf( stderr, "usage: %s [-n iterations] file.hpgl ...\n", argv[0] );
+        return EXIT_FAILURE;
+    }
+
+    for( gint i = 0; i < NUM_HPGL_PENS; i++ )
+        pGlobal->HPGLpens[ i ] = HPGLpensFactory[ i ];
+    initializeHPGL( pGlobal, TRUE );
+
+    printf( "HPGLplotter benchmark: %d iterations, %d threads\n", iterations, g_get_num_processors() );
+
+    for( ; iArg < argc; iArg++ ) {
+        GError *err = NULL;
+        GMappedFile *pMappedFile = g_mapped_file_new( argv[ iArg ], FALSE, &err );
+
+        if( pMappedFile == NULL ) {
+            fprintf( stderr, "%s: %s\n", argv[ iArg ], err->message );
+            g_clear_error( &err );
+            continue;
+        }
+
+        const gchar *sHPGL = g_mapped_file_get_contents( pMappedFile );
+        gsize length = g_mapped_file_get_length( pMappedFile );
+
+        printf( "%s (%" G_GSIZE_FORMAT " bytes)\n", argv[ iArg ], length );
+        if( length > 0 ) {
+            benchCompile( pGlobal, sHPGL, length, iterations, FALSE );
+            benchCompile( pGlobal, sHPGL, length, iterations, TRUE );
+            benchRender( pGlobal, iterations );
+        }
+
+        g_mapped_file_unref( pMappedFile );
+    }
+
+    freeCompiledHPGL( &pGlobal->plotHPGL );
+    freeLabelFontCache();
+    return EXIT_SUCCESS;
+}
@@ -170,6 +170,7 @@ CB_KeyPressed (GObject             *dataObject,
             switch (state & (GDK_SHIFT_MASK | GDK_CONTROL_MASK | GDK_ALT_MASK | GDK_SUPER_MASK) ) {
             case GDK_SHIFT_MASK:
                 initializeHPGL( pGlobal, TRUE );
+                invalidatePlotCache( pGlobal );
                 wAspectFrame = WLOOKUP( pGlobal, "AspectFrame");
                 gtk_aspect_frame_set_ratio( GTK_ASPECT_FRAME( wAspectFrame ), sqrt( 2.0 ) );
                 wDrawingArea = WLOOKUP( pGlobal, "drawing_Plot");
@@ -179,6 +180,7 @@ CB_KeyPressed (GObject             *dataObject,
                 break;
             case GDK_CONTROL_MASK:
                 initializeHPGL( pGlobal, FALSE );
+                invalidatePlotCache( pGlobal );
                 wAspectFrame = WLOOKUP( pGlobal, "AspectFrame");
                 gtk_aspect_frame_set_ratio( GTK_ASPECT_FRAME( wAspectFrame ), 1.0/sqrt( 2.0 ) );
                 wDrawingArea = WLOOKUP( pGlobal, "drawing_Plot");
@@ -311,6 +313,22 @@ on_shutdown (GApplication *app, gpointer userData)
         g_thread_join( pGlobal->pGThread );
         g_thread_unref( pGlobal->pGThread );
     }
+    if( pGlobal->plotResizeTimer )
+        g_source_remove( pGlobal->plotResizeTimer );
+    messageData = g_malloc0( sizeof(messageEventData) );
+    messageData->command = TR_END;
+    g_async_queue_push( pGlobal->messageQueueToRender, messageData );
+    if( pGlobal->pRenderThread ) {
+        g_thread_join( pGlobal->pRenderThread );
+        g_thread_unref( pGlobal->pRenderThread );
+    }
+    if( pGlobal->plotFrame )
+        cairo_surface_destroy( pGlobal->plotFrame );
+    pGlobal->plotFrame = NULL;
+
+    freeHPGLparser( pGlobal->pHPGLparser );
+    freeCompiledHPGL( &pGlobal->plotHPGL );
+    freeLabelFontCache();
 
     // Destroy queue and source
     g_async_queue_unref( pGlobal->messageQueueToMain );
@@ -325,6 +343,7 @@ on_shutdown (GApplication *app, gpointer userData)
     g_free( pGlobal->sUsersPDFImageFilename );
     g_free( pGlobal->sUsersPNGImageFilename );
     g_free( pGlobal->sUsersSVGImageFilename );
+    g_free( pGlobal->sUsersAllImageFilename );
 
     LOG( G_LOG_LEVEL_INFO, "HPGLplotter ending");
 }
@@ -483,6 +502,8 @@ on_activate (GApplication *app, gpointer udata)
     pGlobal->timeSinceLastHPGLcommand = g_timer_new();
     // Start the GPIB communication thread
     pGlobal->pGThread = g_thread_new( "GPIBthread", threadGPIB, (gpointer)pGlobal );
+    // Start the thread that draws the plot for the screen
+    pGlobal->pRenderThread = g_thread_new( "renderThread", threadRender, (gpointer)pGlobal );
 
     if( conSystemBus ) {
         g_dbus_connection_signal_subscribe( conSystemBus,
@@ -537,6 +558,10 @@ on_startup (GApplication *app, gpointer udata)
     pGlobal->messageQueueToMain = g_async_queue_new();
     pGlobal->messageEventSource = g_source_new( &messageEventFunctions, sizeof(GSource) );
     pGlobal->messageQueueToGPIB = g_async_queue_new();
+    pGlobal->messageQueueToRender = g_async_queue_new();
+    g_mutex_init( &pGlobal->plotFrameMutex );
+    g_mutex_init( &pGlobal->plotHPGLmutex );
+    pGlobal->plotHPGL.pMutex = &pGlobal->plotHPGLmutex;
 
     g_source_attach( globalData.messageEventSource, NULL );
 
@@ -547,6 +572,9 @@ on_startup (GApplication *app, gpointer udata)
     initializeHPGL( pGlobal, TRUE );
     recoverSettings( pGlobal );
 
+    // The parser for HPGL received from the instrument
+    pGlobal->pHPGLparser = newHPGLparser( &pGlobal->plotHPGL, TRUE, pGlobal );
+
     if( bEOIonLF ) {
         pGlobal->flags.bEOIonLF = TRUE;
     }
@@ -28,9 +28,12 @@
 
 #include <HPGLplotter.h>
 #include <math.h>
+#include "messageEvent.h"
 
 
-#define PNG_WIDTH       3300
+// Pixels on the long side of a PNG image (a band of rows must fit a cairo image surface)
+#define PNG_MIN_SIZE    500
+#define PNG_MAX_SIZE    32000
 
 tPaperDimensions paperDimensions[ eNumPaperSizes ] = {
         {595,  842,  7.2},  // A4
@@ -40,17 +43,364 @@ tPaperDimensions paperDimensions[ eNumPaperSizes ] = {
 };
 
 
-/*!     \brief  Write the PDF image to a file
+// Steps in which the progress of a PDF or SVG export is shown
+#define EXPORT_PROGRESS_STEPS   20
+
+/*!     \brief  Show the progress of an export in the status bar
+ *
+ * Called from the export job (not the main loop), so the progress is posted.
+ * Only every 1/EXPORT_PROGRESS_STEPS of the way is shown.
  *
- * Determine the filename to use for the PNG file and
- * write image(s) of plot using the already retrieved data to the file.
+ * \param pJob      pointer to the export job
+ * \param fraction  fraction of the export done
+ */
+void
+postExportProgress( tExportJob *pJob, gdouble fraction ) {
+    gint step = fraction * EXPORT_PROGRESS_STEPS;
+
+    if( step > pJob->progressStep && step < EXPORT_PROGRESS_STEPS ) {
+        gchar *sMessage = g_strdup_printf( "Saving %s .. %d%%", pJob->sBasename,
+                step * 100 / EXPORT_PROGRESS_STEPS );
+        pJob->progressStep = step;
+        postInfo( sMessage );
+        g_free( sMessage );
+    }
+}
+
+/*!     \brief  Free an export job
  *
- * \param  wButton  file pointer to the open, writable file
- * \param  pGlobal	pointer to data
+ * \param pJob      pointer to the export job
  */
+static void
+freeExportJob( gpointer pJob ) {
+    tExportJob *pExportJob = pJob;
 
+    freeCompiledHPGL( &pExportJob->snapshot.plotHPGL );
+    g_free( pExportJob->sFilename );
+    g_free( pExportJob->sBasename );
+    g_free( pExportJob );
+}
+
+/*!     \brief  Set the size of the page (PDF or SVG) or image (PNG) of an export
+ *
+ * \param pJob      pointer to the export job
+ */
+static void
+setExportSize( tExportJob *pJob ) {
+    switch( pJob->fileType ) {
+    case ePDF:
+    case eSVG:
+    default:
+        if( pJob->bPortrait ) {
+            pJob->width  = paperDimensions[pJob->paperSize].height;
+            pJob->height = paperDimensions[pJob->paperSize].width;
+        } else {
+            pJob->width  = paperDimensions[pJob->paperSize].width;
+            pJob->height = paperDimensions[pJob->paperSize].height;
+        }
+        break;
+    case ePNG:
+        pJob->PNGsize = CLAMP( pJob->PNGsize, PNG_MIN_SIZE, PNG_MAX_SIZE );
+        if( pJob->bPortrait ) {
+            pJob->width  = round( pJob->PNGsize * pJob->aspectRatio );
+            pJob->height = pJob->PNGsize;
+        } else {
+            pJob->width  = pJob->PNGsize;
+            pJob->height = round( pJob->PNGsize / pJob->aspectRatio );
+        }
+        break;
+    }
+}
 
-enum eFileType { ePDF, eSVG, ePNG };
+/*!     \brief  Find where the plot goes on the page of a PDF or SVG
+ *
+ * \param pJob      pointer to the export job
+ * \param pX        for the offset of the plot on the page
+ * \param pY
+ * \param pWidth    for the size of the plot
+ * \param pHeight
+ */
+static void
+fitPlotToPage( tExportJob *pJob, gdouble *pX, gdouble *pY, gdouble *pWidth, gdouble *pHeight ) {
+    gdouble width = pJob->width, height = pJob->height;
+
+    *pX = *pY = 0.0;
+    // Letter and Tabloid size are not in the ratio of our data ( height = width / sqrt( 2 ) )
+    // we need to adjust
+    if( pJob->bPortrait ) {
+        // aspect ratio is 1/sqrt( 2 )
+        if( (height / width) * pJob->aspectRatio > 1.01 ) {// this should leave A4 and A3 untouched
+            *pY = (height - width / pJob->aspectRatio) / 2.0;
+            height = width / pJob->aspectRatio;
+        } else if( (height / width) * pJob->aspectRatio < 0.99 ) {
+            *pX = (width - height * pJob->aspectRatio) / 2.0;
+            width = height * pJob->aspectRatio;
+        }
+    } else {
+        // aspect ratio is sqrt( 2 )
+        if( (height / width) / pJob->aspectRatio > 1.01 ) {// this should leave A4 and A3 untouched
+            *pX = width - (height * pJob->aspectRatio) / 2.0;
+            width = height * pJob->aspectRatio;
+        } else if( (height / width) / pJob->aspectRatio < 0.99 ) {	// wider
+            *pY = (height - width / pJob->aspectRatio) / 2.0;
+            height = width / pJob->aspectRatio;
+        }
+    }
+    *pWidth = width;
+    *pHeight = height;
+}
+
+/*!     \brief  Draw the snapshot of the plot, showing the progress
+ *
+ * The compiled HPGL is drawn in steps (each continuing from where the last left off).
+ * The lines of each pen (and line type) are merged and stroked as one path at the end,
+ * so vector files have a path for each pen and not one for each line.
+ *
+ * \param cr        cairo context
+ * \param width     width of the plot
+ * \param height    height of the plot
+ * \param pJob      pointer to the export job
+ * \param pGlobal   pointer to global data
+ */
+static void
+drawPlotInSteps( cairo_t *cr, gdouble width, gdouble height, tExportJob *pJob, tGlobal *pGlobal ) {
+    gsize length = pJob->snapshot.plotHPGL.length;
+    tPlotRender render = { .pSnapshot = &pJob->snapshot, .bMergePaths = TRUE };
+
+    cairo_save( cr ); {
+        if( length == 0 ) {
+            plotCompiledHPGLfrom( cr, width, height, 0, &render, pGlobal );
+        } else {
+            for( gint step = 1; step <= EXPORT_PROGRESS_STEPS; step++ ) {
+                plotCompiledHPGLfrom( cr, width, height, MAX( length * step / EXPORT_PROGRESS_STEPS, 1 ),
+                        &render, pGlobal );
+                postExportProgress( pJob, (gdouble)step / EXPORT_PROGRESS_STEPS );
+            }
+            strokeMergedPaths( cr, &render, pGlobal );
+        }
+    } cairo_restore( cr );
+    freePlotRender( &render );
+}
+
+/*!     \brief  Draw the plot into a PDF or SVG file
+ *
+ * The plot is drawn from the snapshot.
+ *
+ * \param pJob      pointer to the export job
+ * \param pGlobal   pointer to global data
+ * \param err       for the error (if the file could not be written)
+ * \return TRUE if the file was written
+ */
+static gboolean
+writeVectorFile( tExportJob *pJob, tGlobal *pGlobal, GError **err ) {
+    gdouble x, y, width, height;
+    cairo_surface_t *cs;
+    cairo_t *cr;
+    cairo_status_t status;
+
+    if( pJob->fileType == ePDF ) {
+        cs = cairo_pdf_surface_create ( pJob->sFilename, pJob->width, pJob->height );
+        cairo_pdf_surface_set_metadata (cs, CAIRO_PDF_METADATA_CREATOR, "Linux GPIB/HPGL plotter");
+    } else {
+        cs = cairo_svg_surface_create ( pJob->sFilename, pJob->width, pJob->height );
+    }
+    cr = cairo_create (cs);
+
+    fitPlotToPage( pJob, &x, &y, &width, &height );
+    cairo_translate( cr, x, y );
+
+    drawPlotInSteps( cr, width, height, pJob, pGlobal );
+
+    cairo_show_page( cr );
+    cairo_destroy( cr );
+
+    cairo_surface_finish( cs );
+    status = cairo_surface_status( cs );
+    cairo_surface_destroy ( cs );
+
+    if( status != CAIRO_STATUS_SUCCESS ) {
+        g_set_error( err, G_FILE_ERROR, G_FILE_ERROR_IO, "%s: %s", pJob->sFilename, cairo_status_to_string( status ) );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*!     \brief  Write the file of an export (PDF, SVG or PNG)
+ *
+ * \param pJob      pointer to the export job
+ * \param pGlobal   pointer to global data
+ * \param err       for the error (if the file could not be written)
+ * \return TRUE if the file was written
+ */
+static gboolean
+writeExportFile( tExportJob *pJob, tGlobal *pGlobal, GError **err ) {
+    if( pJob->fileType == ePNG )
+        return writePNGinBands( pJob, pGlobal, err );
+    else
+        return writeVectorFile( pJob, pGlobal, err );
+}
+
+/*!     \brief  Write one format of an "export all" (GThread function)
+ *
+ * \param pJob      pointer to the export job of the format
+ * \return NULL or the error if the file could not be written
+ */
+static gpointer
+threadExportFormat( gpointer pJob ) {
+    GError *err = NULL;
+
+    writeExportFile( pJob, &globalData, &err );
+    return err;
+}
+
+/*!     \brief  Export the plot to PDF, SVG and PNG files
+ *
+ * The three files are written at the same time, each on a thread of its own.
+ * Each draws the plot from the (one) snapshot of the compiled HPGL, which is
+ * only read. No cairo surface is shared between the threads: a surface painted
+ * by several threads at once is not safe, and a recording painted into another
+ * recording is only referred to (not copied) by it.
+ *
+ * \param pJob      pointer to the export job (the file name is without an extension)
+ * \param pGlobal   pointer to global data
+ * \param err       for the error (if a file could not be written)
+ * \return TRUE if all the files were written
+ */
+static gboolean
+exportAllFormats( tExportJob *pJob, tGlobal *pGlobal, GError **err ) {
+    static const struct {
+        enum eFileType fileType;
+        const gchar *sExtension;
+    } formats[] = { { ePDF, "pdf" }, { eSVG, "svg" }, { ePNG, "png" } };
+    tExportJob *pFormatJobs[ G_N_ELEMENTS( formats ) ];
+    GThread *threads[ G_N_ELEMENTS( formats ) ];
+    gboolean bOK = TRUE;
+
+    for( gint i = 0; i < G_N_ELEMENTS( formats ); i++ ) {
+        tExportJob *pFormatJob = g_new0( tExportJob, 1 );
+
+        pFormatJob->sFilename = g_strdup_printf( "%s.%s", pJob->sFilename, formats[ i ].sExtension );
+        pFormatJob->sBasename = g_path_get_basename( pFormatJob->sFilename );
+        pFormatJob->fileType = formats[ i ].fileType;
+        pFormatJob->bPortrait = pJob->bPortrait;
+        pFormatJob->aspectRatio = pJob->aspectRatio;
+        pFormatJob->paperSize = pJob->paperSize;
+        pFormatJob->PNGformat = pJob->PNGformat;
+        pFormatJob->PNGcompression = pJob->PNGcompression;
+        pFormatJob->PNGsize = pJob->PNGsize;
+        pFormatJob->snapshot = pJob->snapshot;      // (shared .. it is freed with this job)
+        setExportSize( pFormatJob );
+
+        pFormatJobs[ i ] = pFormatJob;
+        threads[ i ] = g_thread_new( "export", threadExportFormat, pFormatJob );
+    }
+
+    for( gint i = 0; i < G_N_ELEMENTS( formats ); i++ ) {
+        GError *errFormat = g_thread_join( threads[ i ] );
+
+        // report the first file that could not be written
+        if( errFormat != NULL ) {
+            if( bOK )
+                g_propagate_error( err, errFormat );
+            else
+                g_error_free( errFormat );
+            bOK = FALSE;
+        }
+        pFormatJobs[ i ]->snapshot.plotHPGL = (tCompiledHPGL){0};
+        freeExportJob( pFormatJobs[ i ] );
+    }
+
+    return bOK;
+}
+
+/*!     \brief  Export the plot to a file (GTask thread function)
+ *
+ * \param task          the task
+ * \param source_object not used
+ * \param pJob          pointer to the export job
+ * \param cancellable   not used
+ */
+static void
+threadExport( GTask *task, gpointer source_object, gpointer pJob, GCancellable *cancellable ) {
+    tExportJob *pExportJob = pJob;
+    GError *err = NULL;
+    gboolean bOK;
+
+    if( pExportJob->fileType == eAllFormats )
+        bOK = exportAllFormats( pExportJob, &globalData, &err );
+    else
+        bOK = writeExportFile( pExportJob, &globalData, &err );
+
+    if( bOK )
+        g_task_return_boolean( task, TRUE );
+    else
+        g_task_return_error( task, err );
+}
+
+/*!     \brief  An export has finished (on the main loop)
+ *
+ * \param source_object not used
+ * \param res           the task
+ * \param gpGlobal      pointer to global data
+ */
+static void
+CB_exportDone( GObject *source_object, GAsyncResult *res, gpointer gpGlobal ) {
+    tExportJob *pJob = g_task_get_task_data( G_TASK( res ) );
+    GError *err = NULL;
+
+    if( g_task_propagate_boolean( G_TASK( res ), &err ) ) {
+        gchar *sMessage = g_strdup_printf( "Saved %s", pJob->sBasename );
+        postInfo( sMessage );
+        g_free( sMessage );
+    } else {
+        postError( err->message );
+        g_clear_error( &err );
+    }
+}
+
+/*!     \brief  Start an export of the plot to a file
+ *
+ * The export is drawn from a snapshot of the plot (compiled HPGL, pens and
+ * plotter sheet) on a thread of its own. The main loop carries on (and
+ * the plot may change) while it is written; more than one export may be
+ * written at once. The progress and the result are shown in the status bar.
+ *
+ * \param sFilename name of the file (without an extension for all formats)
+ * \param fileType  PDF, SVG, PNG or all three
+ * \param pGlobal   pointer to global data
+ */
+static void
+startExportJob( gchar *sFilename, enum eFileType fileType, tGlobal *pGlobal ) {
+    tExportJob *pJob = g_new0( tExportJob, 1 );
+    GTask *task;
+
+    pJob->sFilename = g_strdup( sFilename );
+    if( fileType == eAllFormats ) {
+        gchar *sBasename = g_path_get_basename( sFilename );
+        pJob->sBasename = g_strdup_printf( "%s.{pdf,svg,png}", sBasename );
+        g_free( sBasename );
+    } else {
+        pJob->sBasename = g_path_get_basename( sFilename );
+    }
+    pJob->fileType = fileType;
+    pJob->bPortrait = pGlobal->flags.bPortrait;
+    pJob->aspectRatio = pGlobal->aspectRatio;
+    pJob->paperSize = pGlobal->PDFpaperSize;
+    pJob->PNGformat = pGlobal->PNGformat;
+    pJob->PNGcompression = pGlobal->PNGcompression;
+    pJob->PNGsize = pGlobal->PNGsize;
+    setExportSize( pJob );
+    takePlotSnapshot( &pJob->snapshot, pGlobal );
+
+    gchar *sMessage = g_strdup_printf( "Saving %s", pJob->sBasename );
+    postInfo( sMessage );
+    g_free( sMessage );
+
+    task = g_task_new( NULL, NULL, CB_exportDone, pGlobal );
+    g_task_set_task_data( task, pJob, freeExportJob );
+    g_task_run_in_thread( task, threadExport );
+    g_object_unref( task );
+}
 
 static gchar *sSuggestedFilename = NULL;
 // Call back when file is selected
@@ -62,10 +412,6 @@ plotAndSaveFile( GObject *source_object, GAsyncResult *res, gpointer gpGlobal, e
     GFile *file;
     GError *err = NULL;
     GtkAlertDialog *alert_dialog;
-    gdouble	width, height;
-
-    cairo_t *cr;
-    cairo_surface_t *cs;
 
     if (((file = gtk_file_dialog_save_finish (dialog, res, &err)) != NULL) ) {
         gchar *sChosenFilename = g_file_get_path( file );
@@ -74,41 +420,22 @@ plotAndSaveFile( GObject *source_object, GAsyncResult *res, gpointer gpGlobal, e
         switch( fileType ) {
         case ePDF:
         default:
-            if( pGlobal->flags.bPortrait ) {
-                width  = paperDimensions[pGlobal->PDFpaperSize].height;
-                height = paperDimensions[pGlobal->PDFpaperSize].width;
-            } else {
-                width  = paperDimensions[pGlobal->PDFpaperSize].width;
-                height = paperDimensions[pGlobal->PDFpaperSize].height;
-            }
-            cs = cairo_pdf_surface_create ( sChosenFilename, width, height );
-            cairo_pdf_surface_set_metadata (cs, CAIRO_PDF_METADATA_CREATOR, "Linux GPIB/HPGL plotter");
             pUserFileName = &pGlobal->sUsersPDFImageFilename;
             break;
         case eSVG:
-            if( pGlobal->flags.bPortrait ) {
-                width  = paperDimensions[pGlobal->PDFpaperSize].height;
-                height = paperDimensions[pGlobal->PDFpaperSize].width;
-            } else {
-                width  = paperDimensions[pGlobal->PDFpaperSize].width;
-                height = paperDimensions[pGlobal->PDFpaperSize].height;
-            }
-            cs = cairo_svg_surface_create ( sChosenFilename, width, height );
             pUserFileName = &pGlobal->sUsersSVGImageFilename;
             break;
         case ePNG:
-            if( pGlobal->flags.bPortrait ) {
-                width  = PNG_WIDTH * pGlobal->aspectRatio;
-                height = PNG_WIDTH;
-            } else {
-                width  = PNG_WIDTH;
-                height = PNG_WIDTH / pGlobal->aspectRatio;
-            }
-            cs = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
             pUserFileName = &pGlobal->sUsersPNGImageFilename;
             break;
+        case eAllFormats:
+            pUserFileName = &pGlobal->sUsersAllImageFilename;
+            // each format adds its own extension
+            if( g_str_has_suffix( sChosenFilename, ".pdf" ) || g_str_has_suffix( sChosenFilename, ".svg" )
+                    || g_str_has_suffix( sChosenFilename, ".png" ) )
+                sChosenFilename[ strlen( sChosenFilename ) - 4 ] = 0;
+            break;
         }
-        cr = cairo_create (cs);
 
         // If the user chose a specific filename .. then remember it for the next time
         if( strcmp( selectedFileBasename, sSuggestedFilename ) ) {
@@ -118,41 +445,7 @@ plotAndSaveFile( GObject *source_object, GAsyncResult *res, gpointer gpGlobal, e
             g_free( selectedFileBasename );
         }
 
-        // Letter and Tabloid size are not in the ratio of our data ( height = width / sqrt( 2 ) )
-        // we need to adjust
-        if( fileType != ePNG )	{	// we know PNG is the right aspect ratio
-            if( pGlobal->flags.bPortrait ) {
-                // aspect ratio is 1/sqrt( 2 )
-                if( (height / width) * pGlobal->aspectRatio > 1.01 ) {// this should leave A4 and A3 untouched
-                    cairo_translate( cr, 0.0, (height - width / pGlobal->aspectRatio) / 2.0  );
-                    height = width / pGlobal->aspectRatio;
-                } else if( (height / width) * pGlobal->aspectRatio < 0.99 ) {
-                    cairo_translate( cr, (width - height * pGlobal->aspectRatio) / 2.0, 0.0  );
-                    width = height * pGlobal->aspectRatio;
-                }
-            } else {
-                // aspect ratio is sqrt( 2 )
-                if( (height / width) / pGlobal->aspectRatio > 1.01 ) {// this should leave A4 and A3 untouched
-                    cairo_translate( cr, width - (height * pGlobal->aspectRatio) / 2.0, 0.0  );
-                    width = height * pGlobal->aspectRatio;
-                } else if( (height / width) / pGlobal->aspectRatio < 0.99 ) {	// wider
-                    cairo_translate( cr, 0.0, (height - width / pGlobal->aspectRatio) / 2.0  );
-                    height = width / pGlobal->aspectRatio;
-                }
-            }
-        }
-
-        cairo_save( cr ); {
-            plotCompiledHPGL( cr, width, height, pGlobal);
-        } cairo_restore( cr );
-
-        cairo_show_page( cr );
-
-        if( fileType  == ePNG )
-            cairo_surface_write_to_png (cs, sChosenFilename );
-
-        cairo_surface_destroy ( cs );
-        cairo_destroy( cr );
+        startExportJob( sChosenFilename, fileType, pGlobal );
 
         GFile *dir = g_file_get_parent( file );
         gchar *sChosenDirectory = g_file_get_path( dir );
@@ -191,6 +484,12 @@ CB_PNGsave( GObject *source_object, GAsyncResult *res, gpointer gpGlobal ) {
     plotAndSaveFile( source_object, res, gpGlobal, ePNG );
 }
 
+// Call back when file is selected
+static void
+CB_AllSave( GObject *source_object, GAsyncResult *res, gpointer gpGlobal ) {
+    plotAndSaveFile( source_object, res, gpGlobal, eAllFormats );
+}
+
 
 void
 presentFileSaveDialog ( GtkButton *wBtn, gpointer user_data, enum eFileType fileType ) {
@@ -227,6 +526,14 @@ presentFileSaveDialog ( GtkButton *wBtn, gpointer user_data, enum eFileType file
         sSuggestedFilename = g_date_time_format( now, "HPGL.%d%b%y.%H%M%S.png");
         pUserFileName = &pGlobal->sUsersPNGImageFilename;
         break;
+    case eAllFormats:
+        gtk_file_filter_add_mime_type (filter, "application/pdf");
+        gtk_file_filter_add_mime_type (filter, "image/svg+xml");
+        gtk_file_filter_add_mime_type (filter, "image/png");
+        gtk_file_filter_set_name (filter, "PDF, SVG & PNG");
+        sSuggestedFilename = g_date_time_format( now, "HPGL.%d%b%y.%H%M%S");
+        pUserFileName = &pGlobal->sUsersAllImageFilename;
+        break;
     default: break;
     }
     g_list_store_append ( (GListStore*)filters, filter);
@@ -255,6 +562,9 @@ presentFileSaveDialog ( GtkButton *wBtn, gpointer user_data, enum eFileType file
     case ePNG:
         gtk_file_dialog_save ( fileDialogSave, GTK_WINDOW (win), NULL, CB_PNGsave, pGlobal);
         break;
+    case eAllFormats:
+        gtk_file_dialog_save ( fileDialogSave, GTK_WINDOW (win), NULL, CB_AllSave, pGlobal);
+        break;
     default:
         break;
     }
@@ -281,3 +591,7 @@ CB_btn_PNG ( GtkButton *wBtnPNG, gpointer user_data ) {
     presentFileSaveDialog ( wBtnPNG, user_data, ePNG );
 }
 
+void
+CB_btn_ExportAll ( GtkButton *wBtnAll, gpointer user_data ) {
+    presentFileSaveDialog ( wBtnAll, user_data, eAllFormats );
+}
@@ -0,0 +1,555 @@
+/*
+ * Copyright (c) 2024 Michael G. Katzmann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file PNGexport.c
+ *  \brief Draw the plot into a PNG file in bands
+ *
+ * The image is split into bands of rows, drawn on a number of threads and
+ * written to the file in order as they are finished. Each thread draws the plot
+ * once into a recording surface of its own, then replays it into the bands it
+ * takes (with a cairo context translated to the band). Only the part of the
+ * recording that falls in a band is replayed, so the work does not grow with
+ * the number of bands. A recording is never painted by more than one thread
+ * (cairo changes a source surface as it is painted). Only a few bands are held
+ * at once, so the image is not limited by the size of one cairo surface and the
+ * time taken falls with the number of processors.
+ *
+ * The image is written in full colour (RGBA), with a palette of the pen colours
+ * (each at a number of levels of coverage, for the anti-aliased edges) or in
+ * monochrome. The deflate level of the image data can be chosen.
+ */
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <zlib.h>
+
+#include <glib-2.0/glib.h>
+#include <cairo/cairo.h>
+
+#include <HPGLplotter.h>
+
+// Bands the image is split into (for each thread), so that the threads finish together ..
+#define PNG_BANDS_PER_THREAD    4
+// .. but no band is bigger than this (bytes) or smaller than this (rows)
+#define PNG_BAND_MAX_SIZE       (8 * 1024 * 1024)
+#define PNG_BAND_MIN_HEIGHT     16
+// Bands drawn ahead of the one being written (for each thread)
+#define PNG_BANDS_AHEAD         2
+// Largest IDAT chunk written
+#define PNG_IDAT_SIZE           (64 * 1024)
+// Levels of coverage of each pen in the palette (the first entry is transparent)
+#define PNG_PALETTE_LEVELS      ((256 - 1) / NUM_HPGL_PENS)
+// Pixels remembered with their palette entry (a power of 2)
+#define PNG_PALETTE_CACHE       4096
+
+// A band of rows of the image
+typedef struct {
+    gint            top, rows;
+    cairo_surface_t *image;                 // the band drawn (NULL until it is)
+} tPNGband;
+
+// The bands of the image and the threads drawing them
+typedef struct {
+    tExportJob      *pJob;
+    tGlobal         *pGlobal;
+    gint            width, height;          // of the image
+    tPNGband        *bands;
+    gint            nBands;
+    gint            nextBand;               // the next band to be drawn ..
+    gint            nWritten;               // .. (no more than nAhead after the bands written)
+    gint            nAhead;
+    GMutex          mutex;                  // the bands drawn and written
+    GCond           drawn, written;
+} tPNGbands;
+
+// The palette of an indexed PNG file
+typedef struct {
+    gint            nEntries;
+    guchar          RGB[ 256 * 3 ];
+    guchar          alpha[ 256 ];
+    gdouble         pens[ NUM_HPGL_PENS ][ 4 ];         // premultiplied RGBA (0 - 255) of each pen
+    guint32         cachePixel[ PNG_PALETTE_CACHE ];    // pixels (premultiplied ARGB) seen ..
+    guchar          cacheEntry[ PNG_PALETTE_CACHE ];    // .. and their palette entry
+} tPNGpalette;
+
+// A PNG file being written
+typedef struct {
+    FILE            *fp;
+    gint            width;
+    enum ePNGformat format;
+    gint            rowBytes;               // (not counting the filter byte)
+    tPNGpalette     *pPalette;              // (palette format)
+    z_stream        stream;                 // deflate of the filtered rows
+    guchar          *idat;                  // compressed data not yet written
+    guchar          *row, *lastRow;         // RGBA of this row and the last (for the filter)
+    guchar          *filteredRow;
+    gboolean        bError;
+} tPNGwriter;
+
+/*!     \brief  Draw the plot into a recording surface (for a thread drawing bands)
+ *
+ * \param pPNGbands pointer to the bands of the image
+ * \return the recording (of the whole image)
+ */
+static cairo_surface_t *
+recordPNGplot( tPNGbands *pPNGbands ) {
+    tPlotRender render = { .pSnapshot = &pPNGbands->pJob->snapshot };
+    cairo_surface_t *recording = cairo_recording_surface_create( CAIRO_CONTENT_COLOR_ALPHA,
+            &(cairo_rectangle_t){ 0.0, 0.0, pPNGbands->width, pPNGbands->height } );
+    cairo_t *cr = cairo_create( recording );
+
+    plotCompiledHPGLfrom( cr, pPNGbands->width, pPNGbands->height,
+            render.pSnapshot->plotHPGL.length, &render, pPNGbands->pGlobal );
+    freePlotRender( &render );
+    cairo_destroy( cr );
+    return recording;
+}
+
+/*!     \brief  Draw a band of the image
+ *
+ * \param pPNGband  pointer to the band
+ * \param pPNGbands pointer to the bands of the image
+ * \param recording the plot (recorded by this thread)
+ */
+static void
+drawPNGband( tPNGband *pPNGband, tPNGbands *pPNGbands, cairo_surface_t *recording ) {
+    cairo_surface_t *cs = cairo_image_surface_create( CAIRO_FORMAT_ARGB32, pPNGbands->width, pPNGband->rows );
+    cairo_t *cr = cairo_create( cs );
+
+    cairo_translate( cr, 0.0, -pPNGband->top );
+    cairo_set_source_surface( cr, recording, 0.0, 0.0 );
+    cairo_paint( cr );
+    cairo_destroy( cr );
+    cairo_surface_flush( cs );
+
+    g_mutex_lock( &pPNGbands->mutex );
+    pPNGband->image = cs;
+    g_cond_broadcast( &pPNGbands->drawn );
+    g_mutex_unlock( &pPNGbands->mutex );
+}
+
+/*!     \brief  Draw bands of the image until there are none left (GThreadPool function)
+ *
+ * The plot is recorded by each thread, so that no recording is painted by
+ * two threads at once.
+ *
+ * \param pWorker   not used (one is pushed for each thread)
+ * \param pBands    pointer to the bands of the image
+ */
+static void
+threadDrawPNGbands( gpointer pWorker, gpointer pBands ) {
+    tPNGbands *pPNGbands = pBands;
+    cairo_surface_t *recording = recordPNGplot( pPNGbands );
+
+    for( ;; ) {
+        gint band = -1;
+
+        // take the next band (if it is not too far ahead of the bands written)
+        g_mutex_lock( &pPNGbands->mutex );
+        while( pPNGbands->nextBand < pPNGbands->nBands
+                && pPNGbands->nextBand >= pPNGbands->nWritten + pPNGbands->nAhead )
+            g_cond_wait( &pPNGbands->written, &pPNGbands->mutex );
+        if( pPNGbands->nextBand < pPNGbands->nBands )
+            band = pPNGbands->nextBand++;
+        g_mutex_unlock( &pPNGbands->mutex );
+
+        if( band < 0 )
+            break;
+        drawPNGband( &pPNGbands->bands[ band ], pPNGbands, recording );
+    }
+    cairo_surface_destroy( recording );
+}
+
+/*!     \brief  Find the height of the bands of an image
+ *
+ * \param width     width of the image
+ * \param height    height of the image
+ * \param nThreads  number of threads drawing the bands
+ * \return rows of the image in each band
+ */
+static gint
+getPNGbandHeight( gint width, gint height, gint nThreads ) {
+    gint nBands = nThreads * PNG_BANDS_PER_THREAD;
+    gint rows = (height + nBands - 1) / nBands;
+
+    rows = MIN( rows, PNG_BAND_MAX_SIZE / (width * 4) );
+    return MAX( rows, PNG_BAND_MIN_HEIGHT );
+}
+
+/*!     \brief  Write a chunk to the PNG file
+ *
+ * \param pWriter   pointer to the PNG writer
+ * \param type      chunk type (e.g. "IDAT")
+ * \param data      chunk data
+ * \param length    length of the chunk data
+ */
+static void
+writePNGchunk( tPNGwriter *pWriter, const gchar *type, const guchar *data, guint32 length ) {
+    guint32 lengthBE = GUINT32_TO_BE( length );
+    guint32 crc = crc32( 0, (const Bytef *)type, 4 );
+
+    if( length > 0 )
+        crc = crc32( crc, data, length );
+    crc = GUINT32_TO_BE( crc );
+
+    if( fwrite( &lengthBE, 4, 1, pWriter->fp ) != 1
+            || fwrite( type, 4, 1, pWriter->fp ) != 1
+            || (length > 0 && fwrite( data, length, 1, pWriter->fp ) != 1)
+            || fwrite( &crc, 4, 1, pWriter->fp ) != 1 )
+        pWriter->bError = TRUE;
+}
+
+/*!     \brief  Compress data into the image data of the PNG file
+ *
+ * Full IDAT chunks are written as they fill.
+ *
+ * \param pWriter   pointer to the PNG writer
+ * \param data      data to compress (NULL to finish)
+ * \param length    length of the data
+ */
+static void
+deflatePNG( tPNGwriter *pWriter, const guchar *data, gsize length ) {
+    gint flush = data ? Z_NO_FLUSH : Z_FINISH;
+    gint status;
+
+    pWriter->stream.next_in = (Bytef *)data;
+    pWriter->stream.avail_in = length;
+    do {
+        status = deflate( &pWriter->stream, flush );
+        if( pWriter->stream.avail_out == 0 || (flush == Z_FINISH && status == Z_STREAM_END) ) {
+            writePNGchunk( pWriter, "IDAT", pWriter->idat, PNG_IDAT_SIZE - pWriter->stream.avail_out );
+            pWriter->stream.next_out = pWriter->idat;
+            pWriter->stream.avail_out = PNG_IDAT_SIZE;
+        }
+    } while( status == Z_OK && (pWriter->stream.avail_in > 0 || flush == Z_FINISH) );
+
+    if( status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR )
+        pWriter->bError = TRUE;
+}
+
+/*!     \brief  Make the palette of the pen colours
+ *
+ * Entry 0 is transparent (the paper). Each pen then has PNG_PALETTE_LEVELS entries,
+ * its colour with rising coverage (alpha), as cairo anti-aliases the edges
+ * of its lines against the paper.
+ *
+ * \param pPalette  pointer to the palette
+ * \param pens      colours of the pens
+ */
+static void
+makePNGpalette( tPNGpalette *pPalette, const GdkRGBA *pens ) {
+    gint entry = 1;
+
+    *pPalette = (tPNGpalette){0};      // (cachePixel 0 is transparent .. entry 0)
+    for( gint pen = 0; pen < NUM_HPGL_PENS; pen++ ) {
+        gdouble alpha = CLAMP( pens[ pen ].alpha, 0.0, 1.0 ) * 255.0;
+
+        pPalette->pens[ pen ][ 0 ] = CLAMP( pens[ pen ].red,   0.0, 1.0 ) * alpha;
+        pPalette->pens[ pen ][ 1 ] = CLAMP( pens[ pen ].green, 0.0, 1.0 ) * alpha;
+        pPalette->pens[ pen ][ 2 ] = CLAMP( pens[ pen ].blue,  0.0, 1.0 ) * alpha;
+        pPalette->pens[ pen ][ 3 ] = alpha;
+
+        for( gint level = 1; level <= PNG_PALETTE_LEVELS; level++, entry++ ) {
+            pPalette->RGB[ entry * 3     ] = lround( CLAMP( pens[ pen ].red,   0.0, 1.0 ) * 255.0 );
+            pPalette->RGB[ entry * 3 + 1 ] = lround( CLAMP( pens[ pen ].green, 0.0, 1.0 ) * 255.0 );
+            pPalette->RGB[ entry * 3 + 2 ] = lround( CLAMP( pens[ pen ].blue,  0.0, 1.0 ) * 255.0 );
+            pPalette->alpha[ entry ] = lround( alpha * level / PNG_PALETTE_LEVELS );
+        }
+    }
+    pPalette->nEntries = entry;
+}
+
+/*!     \brief  Find the palette entry nearest a pixel
+ *
+ * For each pen, the level of coverage is found from the alpha of the pixel;
+ * the pen nearest the pixel at that level is chosen. Plots have few
+ * colours, so the entries found are remembered.
+ *
+ * \param pPalette  pointer to the palette
+ * \param pixel     premultiplied ARGB of the pixel
+ * \return the palette entry
+ */
+static inline guchar
+paletteEntry( tPNGpalette *pPalette, guint32 pixel ) {
+    guint cache = (pixel * 2654435761u) >> 20 & (PNG_PALETTE_CACHE - 1);
+    gdouble ARGB[ 4 ] = { (pixel >> 16) & 0xFF, (pixel >> 8) & 0xFF, pixel & 0xFF, pixel >> 24 };
+    gdouble nearest = G_MAXDOUBLE;
+    guchar entry = 0;
+
+    if( pPalette->cachePixel[ cache ] == pixel )
+        return pPalette->cacheEntry[ cache ];
+
+    for( gint pen = 0; pen < NUM_HPGL_PENS; pen++ ) {
+        const gdouble *penRGBA = pPalette->pens[ pen ];
+        gint level;
+        gdouble coverage, distance = 0.0;
+
+        if( penRGBA[ 3 ] <= 0.0 )
+            continue;
+        level = CLAMP( lround( ARGB[ 3 ] * PNG_PALETTE_LEVELS / penRGBA[ 3 ] ), 1, PNG_PALETTE_LEVELS );
+        coverage = (gdouble)level / PNG_PALETTE_LEVELS;
+        for( gint i = 0; i < 4; i++ )
+            distance += (ARGB[ i ] - penRGBA[ i ] * coverage) * (ARGB[ i ] - penRGBA[ i ] * coverage);
+
+        if( distance < nearest ) {
+            nearest = distance;
+            entry = 1 + pen * PNG_PALETTE_LEVELS + level - 1;
+        }
+    }
+    // transparent (or nearly so)?
+    if( ARGB[ 0 ] * ARGB[ 0 ] + ARGB[ 1 ] * ARGB[ 1 ] + ARGB[ 2 ] * ARGB[ 2 ] + ARGB[ 3 ] * ARGB[ 3 ] < nearest )
+        entry = 0;
+
+    pPalette->cachePixel[ cache ] = pixel;
+    pPalette->cacheEntry[ cache ] = entry;
+    return entry;
+}
+
+/*!     \brief  Start a PNG file
+ *
+ * Full colour is 8 bit RGBA, the pen palette 8 bit indexed (with transparency)
+ * and monochrome 1 bit indexed (black on white).
+ *
+ * \param pWriter   pointer to the PNG writer
+ * \param pJob      pointer to the export job (file name, size, format and pens)
+ * \param err       for the error (if the file cannot be created)
+ * \return TRUE if the file was created
+ */
+static gboolean
+startPNG( tPNGwriter *pWriter, tExportJob *pJob, GError **err ) {
+    static const guchar signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    static const guchar monochromePLTE[] = { 0xFF, 0xFF, 0xFF,  0x00, 0x00, 0x00 };
+    gint width = pJob->width, height = pJob->height;
+    guchar IHDR[ 13 ];
+    guint32 widthBE = GUINT32_TO_BE( width ), heightBE = GUINT32_TO_BE( height );
+
+    *pWriter = (tPNGwriter){0};
+    if( (pWriter->fp = fopen( pJob->sFilename, "wb" )) == NULL ) {
+        g_set_error( err, G_FILE_ERROR, g_file_error_from_errno( errno ),
+                "%s: %s", pJob->sFilename, g_strerror( errno ) );
+        return FALSE;
+    }
+    pWriter->width = width;
+    pWriter->format = pJob->PNGformat;
+
+    memcpy( IHDR, &widthBE, 4 );
+    memcpy( IHDR + 4, &heightBE, 4 );
+    switch( pWriter->format ) {
+    case ePNGcolour:
+    default:
+        pWriter->format = ePNGcolour;
+        pWriter->rowBytes = width * 4;
+        IHDR[ 8 ] = 8;      // bits
+        IHDR[ 9 ] = 6;      // RGBA
+        break;
+    case ePNGpalette:
+        pWriter->rowBytes = width;
+        IHDR[ 8 ] = 8;      // bits
+        IHDR[ 9 ] = 3;      // indexed
+        break;
+    case ePNGmonochrome:
+        pWriter->rowBytes = (width + 7) / 8;
+        IHDR[ 8 ] = 1;      // bit
+        IHDR[ 9 ] = 3;      // indexed
+        break;
+    }
+    IHDR[ 10 ] = 0;     // deflate
+    IHDR[ 11 ] = 0;     // adaptive filtering
+    IHDR[ 12 ] = 0;     // not interlaced
+    if( fwrite( signature, sizeof( signature ), 1, pWriter->fp ) != 1 )
+        pWriter->bError = TRUE;
+    writePNGchunk( pWriter, "IHDR", IHDR, sizeof( IHDR ) );
+
+    if( pWriter->format == ePNGpalette ) {
+        pWriter->pPalette = g_new( tPNGpalette, 1 );
+        makePNGpalette( pWriter->pPalette, pJob->snapshot.HPGLpens );
+        writePNGchunk( pWriter, "PLTE", pWriter->pPalette->RGB, pWriter->pPalette->nEntries * 3 );
+        writePNGchunk( pWriter, "tRNS", pWriter->pPalette->alpha, pWriter->pPalette->nEntries );
+    } else if( pWriter->format == ePNGmonochrome ) {
+        writePNGchunk( pWriter, "PLTE", monochromePLTE, sizeof( monochromePLTE ) );
+    }
+
+    pWriter->idat = g_malloc( PNG_IDAT_SIZE );
+    pWriter->row = g_malloc( pWriter->rowBytes );
+    pWriter->lastRow = g_malloc0( pWriter->rowBytes );
+    pWriter->filteredRow = g_malloc( pWriter->rowBytes + 1 );
+    deflateInit( &pWriter->stream, CLAMP( pJob->PNGcompression, Z_NO_COMPRESSION, Z_BEST_COMPRESSION ) );
+    pWriter->stream.next_out = pWriter->idat;
+    pWriter->stream.avail_out = PNG_IDAT_SIZE;
+
+    return TRUE;
+}
+
+/*!     \brief  Write the rows of a band to the PNG file
+ *
+ * The premultiplied ARGB of cairo is written as RGBA, as the palette entry
+ * nearest each pixel or as black where a pixel is at least half covered.
+ * Full colour rows use the 'up' filter (as plots have much the same from row to row);
+ * indexed rows are not filtered.
+ *
+ * \param pWriter   pointer to the PNG writer
+ * \param csBand    image surface of the band (ARGB32)
+ */
+static void
+writePNGrows( tPNGwriter *pWriter, cairo_surface_t *csBand ) {
+    const guchar *data = cairo_image_surface_get_data( csBand );
+    gint stride = cairo_image_surface_get_stride( csBand );
+    gint rows = cairo_image_surface_get_height( csBand );
+
+    for( gint y = 0; y < rows; y++ ) {
+        const guint32 *pixel = (const guint32 *)(data + y * stride);
+        guchar *row = pWriter->row, *lastRow = pWriter->lastRow;
+
+        switch( pWriter->format ) {
+        case ePNGcolour:
+        default:
+            for( gint x = 0; x < pWriter->width; x++, row += 4 ) {
+                guint alpha = pixel[ x ] >> 24;
+
+                if( alpha == 0 ) {
+                    row[ 0 ] = row[ 1 ] = row[ 2 ] = row[ 3 ] = 0;
+                } else {
+                    row[ 0 ] = (((pixel[ x ] >> 16) & 0xFF) * 255 + alpha / 2) / alpha;
+                    row[ 1 ] = (((pixel[ x ] >>  8) & 0xFF) * 255 + alpha / 2) / alpha;
+                    row[ 2 ] = (((pixel[ x ]      ) & 0xFF) * 255 + alpha / 2) / alpha;
+                    row[ 3 ] = alpha;
+                }
+            }
+
+            pWriter->filteredRow[ 0 ] = 2;      // up
+            for( gint i = 0; i < pWriter->rowBytes; i++ )
+                pWriter->filteredRow[ i + 1 ] = pWriter->row[ i ] - lastRow[ i ];
+            break;
+        case ePNGpalette:
+            for( gint x = 0; x < pWriter->width; x++ )
+                row[ x ] = paletteEntry( pWriter->pPalette, pixel[ x ] );
+
+            pWriter->filteredRow[ 0 ] = 0;      // none
+            memcpy( pWriter->filteredRow + 1, row, pWriter->rowBytes );
+            break;
+        case ePNGmonochrome:
+            memset( row, 0, pWriter->rowBytes );
+            for( gint x = 0; x < pWriter->width; x++ )
+                if( (pixel[ x ] >> 24) >= 0x80 )
+                    row[ x / 8 ] |= 0x80 >> (x % 8);
+
+            pWriter->filteredRow[ 0 ] = 0;      // none
+            memcpy( pWriter->filteredRow + 1, row, pWriter->rowBytes );
+            break;
+        }
+        deflatePNG( pWriter, pWriter->filteredRow, pWriter->rowBytes + 1 );
+
+        pWriter->lastRow = pWriter->row;
+        pWriter->row = lastRow;
+    }
+}
+
+/*!     \brief  Finish the PNG file
+ *
+ * \param pWriter   pointer to the PNG writer
+ * \param sFilename name of the file
+ * \param err       for the error (if the file could not be written)
+ * \return TRUE if the whole file was written
+ */
+static gboolean
+finishPNG( tPNGwriter *pWriter, const gchar *sFilename, GError **err ) {
+    deflatePNG( pWriter, NULL, 0 );
+    writePNGchunk( pWriter, "IEND", NULL, 0 );
+    deflateEnd( &pWriter->stream );
+
+    if( fclose( pWriter->fp ) != 0 )
+        pWriter->bError = TRUE;
+    if( pWriter->bError )
+        g_set_error( err, G_FILE_ERROR, G_FILE_ERROR_IO, "%s: could not write the PNG image", sFilename );
+
+    g_free( pWriter->idat );
+    g_free( pWriter->row );
+    g_free( pWriter->lastRow );
+    g_free( pWriter->filteredRow );
+    g_free( pWriter->pPalette );
+
+    return !pWriter->bError;
+}
+
+/*!     \brief  Draw the plot into a PNG file
+ *
+ * The bands of the image are drawn on a pool of threads and written
+ * in order as they are finished.
+ *
+ * \param pJob      pointer to the export job (file name, size and snapshot of the plot)
+ * \param pGlobal   pointer to global data
+ * \param err       for the error (if the file could not be written)
+ * \return TRUE if the file was written
+ */
+gboolean
+writePNGinBands( tExportJob *pJob, tGlobal *pGlobal, GError **err ) {
+    const gchar *sFilename = pJob->sFilename;
+    gint width = pJob->width, height = pJob->height;
+    tPNGwriter writer;
+    tPNGbands bands = { .pJob = pJob, .pGlobal = pGlobal, .width = width, .height = height };
+    gint nThreads = g_get_num_processors();
+    gint bandHeight = getPNGbandHeight( width, height, nThreads );
+    gint nBands = (height + bandHeight - 1) / bandHeight;
+    GThreadPool *pool;
+
+    if( !startPNG( &writer, pJob, err ) )
+        return FALSE;
+
+    bands.bands = g_new0( tPNGband, nBands );
+    bands.nBands = nBands;
+    bands.nAhead = nThreads * PNG_BANDS_AHEAD;
+    for( gint i = 0; i < nBands; i++ ) {
+        bands.bands[ i ].top = i * bandHeight;
+        bands.bands[ i ].rows = MIN( bandHeight, height - bands.bands[ i ].top );
+    }
+    g_mutex_init( &bands.mutex );
+    g_cond_init( &bands.drawn );
+    g_cond_init( &bands.written );
+
+    // each thread takes bands until there are none left
+    nThreads = MIN( nThreads, nBands );
+    pool = g_thread_pool_new( threadDrawPNGbands, &bands, nThreads, FALSE, NULL );
+    for( gint i = 0; i < nThreads; i++ )
+        g_thread_pool_push( pool, GINT_TO_POINTER( i + 1 ), NULL );
+
+    for( gint i = 0; i < nBands; i++ ) {
+        cairo_surface_t *csBand;
+
+        g_mutex_lock( &bands.mutex );
+        while( bands.bands[ i ].image == NULL )
+            g_cond_wait( &bands.drawn, &bands.mutex );
+        csBand = bands.bands[ i ].image;
+        bands.bands[ i ].image = NULL;
+        // the threads may draw a band further on while this one is written
+        bands.nWritten = i + 1;
+        g_cond_broadcast( &bands.written );
+        g_mutex_unlock( &bands.mutex );
+
+        writePNGrows( &writer, csBand );
+        cairo_surface_destroy( csBand );
+        postExportProgress( pJob, (gdouble)(i + 1) / nBands );
+    }
+    g_thread_pool_free( pool, FALSE, TRUE );
+
+    g_mutex_clear( &bands.mutex );
+    g_cond_clear( &bands.drawn );
+    g_cond_clear( &bands.written );
+    g_free( bands.bands );
+
+    return finishPNG( &writer, sFilename, err );
+}
@@ -28,153 +28,160 @@
 #include "messageEvent.h"
 
 #define N_CODE_SETS 10
-static const gchar *codeSets7475A[ N_CODE_SETS ][ 127-33 ] = {
+// The code sets are packed UTF-8 (with the length of each character) so that a label
+// can be translated by copying the table entries
+#define MAX_CODE_SET_CHAR_LENGTH    7
+typedef struct {
+    gchar   utf8[ MAX_CODE_SET_CHAR_LENGTH ];   // not null terminated
+    guint8  length;
+} tCodeSetChar;
+#define U8(s)   { s, sizeof( s ) - 1 }
+
+static const tCodeSetChar codeSets7475A[ N_CODE_SETS ][ 127-33 ] = {
         {
                 // 0     33   34   35   36   37   38   39   40   41   42   43   44   45   46   47   48
-                "!", "\"","#", "$", "%", "&", "'", "(", ")", "*", "+", ",", "-", ".", "/", "0",
+                U8("!"), U8("\""),U8("#"), U8("$"), U8("%"), U8("&"), U8("'"), U8("("), U8(")"), U8("*"), U8("+"), U8(","), U8("-"), U8("."), U8("/"), U8("0"),
                 //       49   50   51   52   53   54   55   56   57   58   59   60   61   62   63   64
-                "1", "2", "3", "4", "5", "6", "7", "8", "9", ":", ";", "<", "=", ">", "?", "@",
+                U8("1"), U8("2"), U8("3"), U8("4"), U8("5"), U8("6"), U8("7"), U8("8"), U8("9"), U8(":"), U8(";"), U8("<"), U8("="), U8(">"), U8("?"), U8("@"),
                 //       65   66   67   68   69   70   71   72   73   74   75   76   77   78   79   80
-                "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M", "N", "O", "P",
+                U8("A"), U8("B"), U8("C"), U8("D"), U8("E"), U8("F"), U8("G"), U8("H"), U8("I"), U8("J"), U8("K"), U8("L"), U8("M"), U8("N"), U8("O"), U8("P"),
                 //       81   82   83   84   85   86   87   88   89   90   91   92   93   94   95   96
-                "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z", "[", "\\","]", "^", "_", "`",
+                U8("Q"), U8("R"), U8("S"), U8("T"), U8("U"), U8("V"), U8("W"), U8("X"), U8("Y"), U8("Z"), U8("["), U8("\\"),U8("]"), U8("^"), U8("_"), U8("`"),
                 //       97   98   99   100  101  102  103  104  105  106  107  108  109  110  111  112
-                "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o", "p",
+                U8("a"), U8("b"), U8("c"), U8("d"), U8("e"), U8("f"), U8("g"), U8("h"), U8("i"), U8("j"), U8("k"), U8("l"), U8("m"), U8("n"), U8("o"), U8("p"),
                 //       113  114  115  116  117  118  119  120  121  122  123  124  125  126
-                "q", "r", "s", "t", "u", "v", "w", "x", "y", "z", "{", "|", "}", "~"
+                U8("q"), U8("r"), U8("s"), U8("t"), U8("u"), U8("v"), U8("w"), U8("x"), U8("y"), U8("z"), U8("{"), U8("|"), U8("}"), U8("~")
         },
         {
                 // 1     33   34   35   36   37   38   39   40   41   42   43   44   45   46   47   48
-                "!", "\"","#", "$", "%", "&", "'", "(", ")", "*", "+", ",", "-", ".", "/", "0",
+                U8("!"), U8("\""),U8("#"), U8("$"), U8("%"), U8("&"), U8("'"), U8("("), U8(")"), U8("*"), U8("+"), U8(","), U8("-"), U8("."), U8("/"), U8("0"),
                 //       49   50   51   52   53   54   55   56   57   58   59   60   61   62   63   64
-                "1", "2", "3", "4", "5", "6", "7", "8", "9", ":", ";", "<", "=", ">", "?", "@",
+                U8("1"), U8("2"), U8("3"), U8("4"), U8("5"), U8("6"), U8("7"), U8("8"), U8("9"), U8(":"), U8(";"), U8("<"), U8("="), U8(">"), U8("?"), U8("@"),
                 //       65   66   67   68   69   70   71   72   73   74   75   76   77   78   79   80
-                "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M", "N", "O", "P",
+                U8("A"), U8("B"), U8("C"), U8("D"), U8("E"), U8("F"), U8("G"), U8("H"), U8("I"), U8("J"), U8("K"), U8("L"), U8("M"), U8("N"), U8("O"), U8("P"),
                 //       81   82   83   84   85   86   87   88   89   90   91   92   93   94   95   96
-                "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z", "[", "√", "]", "↑", "_\b", "`\b",
+                U8("Q"), U8("R"), U8("S"), U8("T"), U8("U"), U8("V"), U8("W"), U8("X"), U8("Y"), U8("Z"), U8("["), U8("√"), U8("]"), U8("↑"), U8("_\b"), U8("`\b"),
                 //       97   98   99   100  101  102  103  104  105  106  107  108  109  110  111  112
-                "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o", "p",
+                U8("a"), U8("b"), U8("c"), U8("d"), U8("e"), U8("f"), U8("g"), U8("h"), U8("i"), U8("j"), U8("k"), U8("l"), U8("m"), U8("n"), U8("o"), U8("p"),
                 //       113  114  115  116  117  118  119  120  121  122  123  124  125  126
-                "q", "r", "s", "t", "u", "v", "w", "x", "y", "z", "π", "Ⱶ", "→", "~\b"
+                U8("q"), U8("r"), U8("s"), U8("t"), U8("u"), U8("v"), U8("w"), U8("x"), U8("y"), U8("z"), U8("π"), U8("Ⱶ"), U8("→"), U8("~\b")
         },
         {
                 // 2     33   34   35   36   37   38   39   40   41   42   43   44   45   46   47   48
-                "!", "\"","£", "$", "%", "&", "´\b", "(", ")", "*", "+", ",", "-", ".", "/", "0",
+                U8("!"), U8("\""),U8("£"), U8("$"), U8("%"), U8("&"), U8("´\b"), U8("("), U8(")"), U8("*"), U8("+"), U8(","), U8("-"), U8("."), U8("/"), U8("0"),
                 //       49   50   51   52   53   54   55   56   57   58   59   60   61   62   63   64
-                "1", "2", "3", "4", "5", "6", "7", "8", "9", ":", ";", "<", "=", ">", "?", "@",
+                U8("1"), U8("2"), U8("3"), U8("4"), U8("5"), U8("6"), U8("7"), U8("8"), U8("9"), U8(":"), U8(";"), U8("<"), U8("="), U8(">"), U8("?"), U8("@"),
                 //       65   66   67   68   69   70   71   72   73   74   75   76   77   78   79   80
-                "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M", "N", "O", "P",
+                U8("A"), U8("B"), U8("C"), U8("D"), U8("E"), U8("F"), U8("G"), U8("H"), U8("I"), U8("J"), U8("K"), U8("L"), U8("M"), U8("N"), U8("O"), U8("P"),
                 //       81   82   83   84   85   86   87   88   89   90   91   92   93   94   95   96
-                "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z", "[", "ç", "]", "ˆ\b", "_\b", "`\b",
+                U8("Q"), U8("R"), U8("S"), U8("T"), U8("U"), U8("V"), U8("W"), U8("X"), U8("Y"), U8("Z"), U8("["), U8("ç"), U8("]"), U8("ˆ\b"), U8("_\b"), U8("`\b"),
                 //       97   98   99   100  101  102  103  104  105  106  107  108  109  110  111  112
-                "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o", "p",
+                U8("a"), U8("b"), U8("c"), U8("d"), U8("e"), U8("f"), U8("g"), U8("h"), U8("i"), U8("j"), U8("k"), U8("l"), U8("m"), U8("n"), U8("o"), U8("p"),
                 //       113  114  115  116  117  118  119  120  121  122  123  124  125  126
-                "q", "r", "s", "t", "u", "v", "w", "x", "y", "z", "¨\b", "˙\b", "˙\b", "'"
+                U8("q"), U8("r"), U8("s"), U8("t"), U8("u"), U8("v"), U8("w"), U8("x"), U8("y"), U8("z"), U8("¨\b"), U8("˙\b"), U8("˙\b"), U8("'")
         },
         {
                 // 3     33   34   35   36   37   38   39   40   41   42   43   44   45   46   47   48
-                "!", "\"","£", "$", "%", "&", "'", "(", ")", "*", "+", ",", "-", ".", "/", "0",
+                U8("!"), U8("\""),U8("£"), U8("$"), U8("%"), U8("&"), U8("'"), U8("("), U8(")"), U8("*"), U8("+"), U8(","), U8("-"), U8("."), U8("/"), U8("0"),
                 //       49   50   51   52   53   54   55   56   57   58   59   60   61   62   63   64
-                "1", "2", "3", "4", "5", "6", "7", "8", "9", ":", ";", "<", "=", ">", "?", "@",
+                U8("1"), U8("2"), U8("3"), U8("4"), U8("5"), U8("6"), U8("7"), U8("8"), U8("9"), U8(":"), U8(";"), U8("<"), U8("="), U8(">"), U8("?"), U8("@"),
                 //       65   66   67   68   69   70   71   72   73   74   75   76   77   78   79   80
-                "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M", "N", "O", "P",
+                U8("A"), U8("B"), U8("C"), U8("D"), U8("E"), U8("F"), U8("G"), U8("H"), U8("I"), U8("J"), U8("K"), U8("L"), U8("M"), U8("N"), U8("O"), U8("P"),
                 //       81   82   83   84   85   86   87   88   89   90   91   92   93   94   95   96
-                "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z", "0", "Æ", "𝟶", "æ", "_\b", "`",
+                U8("Q"), U8("R"), U8("S"), U8("T"), U8("U"), U8("V"), U8("W"), U8("X"), U8("Y"), U8("Z"), U8("0"), U8("Æ"), U8("𝟶"), U8("æ"), U8("_\b"), U8("`"),
                 //       97   98   99   100  101  102  103  104  105  106  107  108  109  110  111  112
-                "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o", "p",
+                U8("a"), U8("b"), U8("c"), U8("d"), U8("e"), U8("f"), U8("g"), U8("h"), U8("i"), U8("j"), U8("k"), U8("l"), U8("m"), U8("n"), U8("o"), U8("p"),
                 //       113  114  115  116  117  118  119  120  121  122  123  124  125  126
-                "q", "r", "s", "t", "u", "v", "w", "x", "y", "z", "\b¨", "\b˙", "\b˙", "\b'"
+                U8("q"), U8("r"), U8("s"), U8("t"), U8("u"), U8("v"), U8("w"), U8("x"), U8("y"), U8("z"), U8("\b¨"), U8("\b˙"), U8("\b˙"), U8("\b'")
         },
         {
                 // 4     33   34   35   36   37   38   39   40   41   42   43   44   45   46   47   48
-                "!", "\"","¿", "$", "%", "&", "´\b", "(", ")", "*", "+", ",", "-", ".", "/", "0",
+                U8("!"), U8("\""),U8("¿"), U8("$"), U8("%"), U8("&"), U8("´\b"), U8("("), U8(")"), U8("*"), U8("+"), U8(","), U8("-"), U8("."), U8("/"), U8("0"),
                 //       49   50   51   52   53   54   55   56   57   58   59   60   61   62   63   64
-                "1", "2", "3", "4", "5", "6", "7", "8", "9", ":", ";", "<", "=", ">", "?", "@",
+                U8("1"), U8("2"), U8("3"), U8("4"), U8("5"), U8("6"), U8("7"), U8("8"), U8("9"), U8(":"), U8(";"), U8("<"), U8("="), U8(">"), U8("?"), U8("@"),
                 //       65   66   67   68   69   70   71   72   73   74   75   76   77   78   79   80
-                "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M", "N", "O", "P",
+                U8("A"), U8("B"), U8("C"), U8("D"), U8("E"), U8("F"), U8("G"), U8("H"), U8("I"), U8("J"), U8("K"), U8("L"), U8("M"), U8("N"), U8("O"), U8("P"),
                 //       81   82   83   84   85   86   87   88   89   90   91   92   93   94   95   96
-                "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z", "0", "Æ", "𝟶", "ˆ\b", "_\b", "`",
+                U8("Q"), U8("R"), U8("S"), U8("T"), U8("U"), U8("V"), U8("W"), U8("X"), U8("Y"), U8("Z"), U8("0"), U8("Æ"), U8("𝟶"), U8("ˆ\b"), U8("_\b"), U8("`"),
                 //       97   98   99   100  101  102  103  104  105  106  107  108  109  110  111  112
-                "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o", "p",
+                U8("a"), U8("b"), U8("c"), U8("d"), U8("e"), U8("f"), U8("g"), U8("h"), U8("i"), U8("j"), U8("k"), U8("l"), U8("m"), U8("n"), U8("o"), U8("p"),
                 //       113  114  115  116  117  118  119  120  121  122  123  124  125  126
-                "q", "r", "s", "t", "u", "v", "w", "x", "y", "z", "\b~", "\b~", "\b~", "\b~"
+                U8("q"), U8("r"), U8("s"), U8("t"), U8("u"), U8("v"), U8("w"), U8("x"), U8("y"), U8("z"), U8("\b~"), U8("\b~"), U8("\b~"), U8("\b~")
         },
         // Place-holders .... the following have yet to be properly defined
         // Not Sans does not have APL character code points!
         {
                 // 5     33   34   35   36   37   38   39   40   41   42   43   44   45   46   47   48
-                "!", "\"","#", "$", "%", "&", "'", "(", ")", "*", "+", ",", "-", ".", "/", "0",
+                U8("!"), U8("\""),U8("#"), U8("$"), U8("%"), U8("&"), U8("'"), U8("("), U8(")"), U8("*"), U8("+"), U8(","), U8("-"), U8("."), U8("/"), U8("0"),
                 //       49   50   51   52   53   54   55   56   57   58   59   60   61   62   63   64
-                "1", "2", "3", "4", "5", "6", "7", "8", "9", ":", ";", "<", "=", ">", "?", "@",
+                U8("1"), U8("2"), U8("3"), U8("4"), U8("5"), U8("6"), U8("7"), U8("8"), U8("9"), U8(":"), U8(";"), U8("<"), U8("="), U8(">"), U8("?"), U8("@"),
                 //       65   66   67   68   69   70   71   72   73   74   75   76   77   78   79   80
-                "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M", "N", "O", "P",
+                U8("A"), U8("B"), U8("C"), U8("D"), U8("E"), U8("F"), U8("G"), U8("H"), U8("I"), U8("J"), U8("K"), U8("L"), U8("M"), U8("N"), U8("O"), U8("P"),
                 //       81   82   83   84   85   86   87   88   89   90   91   92   93   94   95   96
-                "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z", "[", "\\","]", "^", "_", "`",
+                U8("Q"), U8("R"), U8("S"), U8("T"), U8("U"), U8("V"), U8("W"), U8("X"), U8("Y"), U8("Z"), U8("["), U8("\\"),U8("]"), U8("^"), U8("_"), U8("`"),
                 //       97   98   99   100  101  102  103  104  105  106  107  108  109  110  111  112
-                "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o", "p",
+                U8("a"), U8("b"), U8("c"), U8("d"), U8("e"), U8("f"), U8("g"), U8("h"), U8("i"), U8("j"), U8("k"), U8("l"), U8("m"), U8("n"), U8("o"), U8("p"),
                 //       113  114  115  116  117  118  119  120  121  122  123  124  125  126
-                "q", "r", "s", "t", "u", "v", "w", "x", "y", "z", "{", "|", "}", "~"
+                U8("q"), U8("r"), U8("s"), U8("t"), U8("u"), U8("v"), U8("w"), U8("x"), U8("y"), U8("z"), U8("{"), U8("|"), U8("}"), U8("~")
         },
         {
                 // 6     33   34   35   36   37   38   39   40   41   42   43   44   45   46   47   48
-                "!", "\"","#", "$", "%", "&", "'", "(", ")", "*", "+", ",", "-", ".", "/", "0",
+                U8("!"), U8("\""),U8("#"), U8("$"), U8("%"), U8("&"), U8("'"), U8("("), U8(")"), U8("*"), U8("+"), U8(","), U8("-"), U8("."), U8("/"), U8("0"),
                 //       49   50   51   52   53   54   55   56   57   58   59   60   61   62   63   64
-                "1", "2", "3", "4", "5", "6", "7", "8", "9", ":", ";", "<", "=", ">", "?", "@",
+                U8("1"), U8("2"), U8("3"), U8("4"), U8("5"), U8("6"), U8("7"), U8("8"), U8("9"), U8(":"), U8(";"), U8("<"), U8("="), U8(">"), U8("?"), U8("@"),
                 //       65   66   67   68   69   70   71   72   73   74   75   76   77   78   79   80
-                "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M", "N", "O", "P",
+                U8("A"), U8("B"), U8("C"), U8("D"), U8("E"), U8("F"), U8("G"), U8("H"), U8("I"), U8("J"), U8("K"), U8("L"), U8("M"), U8("N"), U8("O"), U8("P"),
                 //       81   82   83   84   85   86   87   88   89   90   91   92   93   94   95   96
-                "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z", "[", "\\","]", "^", "_", "`",
+                U8("Q"), U8("R"), U8("S"), U8("T"), U8("U"), U8("V"), U8("W"), U8("X"), U8("Y"), U8("Z"), U8("["), U8("\\"),U8("]"), U8("^"), U8("_"), U8("`"),
                 //       97   98   99   100  101  102  103  104  105  106  107  108  109  110  111  112
-                "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o", "p",
+                U8("a"), U8("b"), U8("c"), U8("d"), U8("e"), U8("f"), U8("g"), U8("h"), U8("i"), U8("j"), U8("k"), U8("l"), U8("m"), U8("n"), U8("o"), U8("p"),
                 //       113  114  115  116  117  118  119  120  121  122  123  124  125  126
-                "q", "r", "s", "t", "u", "v", "w", "x", "y", "z", "{", "|", "}", "~"
+                U8("q"), U8("r"), U8("s"), U8("t"), U8("u"), U8("v"), U8("w"), U8("x"), U8("y"), U8("z"), U8("{"), U8("|"), U8("}"), U8("~")
         },
         {
                 // 7     33   34   35   36   37   38   39   40   41   42   43   44   45   46   47   48
-                "!", "\"","#", "$", "%", "&", "'", "(", ")", "*", "+", ",", "-", ".", "/", "0",
+                U8("!"), U8("\""),U8("#"), U8("$"), U8("%"), U8("&"), U8("'"), U8("("), U8(")"), U8("*"), U8("+"), U8(","), U8("-"), U8("."), U8("/"), U8("0"),
                 //       49   50   51   52   53   54   55   56   57   58   59   60   61   62   63   64
-                "1", "2", "3", "4", "5", "6", "7", "8", "9", ":", ";", "<", "=", ">", "?", "@",
+                U8("1"), U8("2"), U8("3"), U8("4"), U8("5"), U8("6"), U8("7"), U8("8"), U8("9"), U8(":"), U8(";"), U8("<"), U8("="), U8(">"), U8("?"), U8("@"),
                 //       65   66   67   68   69   70   71   72   73   74   75   76   77   78   79   80
-                "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M", "N", "O", "P",
+                U8("A"), U8("B"), U8("C"), U8("D"), U8("E"), U8("F"), U8("G"), U8("H"), U8("I"), U8("J"), U8("K"), U8("L"), U8("M"), U8("N"), U8("O"), U8("P"),
                 //       81   82   83   84   85   86   87   88   89   90   91   92   93   94   95   96
-                "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z", "[", "\\","]", "^", "_", "`",
+                U8("Q"), U8("R"), U8("S"), U8("T"), U8("U"), U8("V"), U8("W"), U8("X"), U8("Y"), U8("Z"), U8("["), U8("\\"),U8("]"), U8("^"), U8("_"), U8("`"),
                 //       97   98   99   100  101  102  103  104  105  106  107  108  109  110  111  112
-                "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o", "p",
+                U8("a"), U8("b"), U8("c"), U8("d"), U8("e"), U8("f"), U8("g"), U8("h"), U8("i"), U8("j"), U8("k"), U8("l"), U8("m"), U8("n"), U8("o"), U8("p"),
                 //       113  114  115  116  117  118  119  120  121  122  123  124  125  126
-                "q", "r", "s", "t", "u", "v", "w", "x", "y", "z", "{", "|", "}", "~"
+                U8("q"), U8("r"), U8("s"), U8("t"), U8("u"), U8("v"), U8("w"), U8("x"), U8("y"), U8("z"), U8("{"), U8("|"), U8("}"), U8("~")
         },
         {
                 // 8     33   34   35   36   37   38   39   40   41   42   43   44   45   46   47   48
-                "!", "\"","#", "$", "%", "&", "'", "(", ")", "*", "+", ",", "-", ".", "/", "0",
+                U8("!"), U8("\""),U8("#"), U8("$"), U8("%"), U8("&"), U8("'"), U8("("), U8(")"), U8("*"), U8("+"), U8(","), U8("-"), U8("."), U8("/"), U8("0"),
                 //       49   50   51   52   53   54   55   56   57   58   59   60   61   62   63   64
-                "1", "2", "3", "4", "5", "6", "7", "8", "9", ":", ";", "<", "=", ">", "?", "@",
+                U8("1"), U8("2"), U8("3"), U8("4"), U8("5"), U8("6"), U8("7"), U8("8"), U8("9"), U8(":"), U8(";"), U8("<"), U8("="), U8(">"), U8("?"), U8("@"),
                 //       65   66   67   68   69   70   71   72   73   74   75   76   77   78   79   80
-                "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M", "N", "O", "P",
+                U8("A"), U8("B"), U8("C"), U8("D"), U8("E"), U8("F"), U8("G"), U8("H"), U8("I"), U8("J"), U8("K"), U8("L"), U8("M"), U8("N"), U8("O"), U8("P"),
                 //       81   82   83   84   85   86   87   88   89   90   91   92   93   94   95   96
-                "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z", "[", "\\","]", "^", "_", "`",
+                U8("Q"), U8("R"), U8("S"), U8("T"), U8("U"), U8("V"), U8("W"), U8("X"), U8("Y"), U8("Z"), U8("["), U8("\\"),U8("]"), U8("^"), U8("_"), U8("`"),
                 //       97   98   99   100  101  102  103  104  105  106  107  108  109  110  111  112
-                "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o", "p",
+                U8("a"), U8("b"), U8("c"), U8("d"), U8("e"), U8("f"), U8("g"), U8("h"), U8("i"), U8("j"), U8("k"), U8("l"), U8("m"), U8("n"), U8("o"), U8("p"),
                 //       113  114  115  116  117  118  119  120  121  122  123  124  125  126
-                "q", "r", "s", "t", "u", "v", "w", "x", "y", "z", "{", "|", "}", "~"
+                U8("q"), U8("r"), U8("s"), U8("t"), U8("u"), U8("v"), U8("w"), U8("x"), U8("y"), U8("z"), U8("{"), U8("|"), U8("}"), U8("~")
         },
         {
                 // 9     33   34   35   36   37   38   39   40   41   42   43   44   45   46   47   48
-                "!", "\"","#", "$", "%", "&", "'", "(", ")", "*", "+", ",", "-", ".", "/", "0",
+                U8("!"), U8("\""),U8("#"), U8("$"), U8("%"), U8("&"), U8("'"), U8("("), U8(")"), U8("*"), U8("+"), U8(","), U8("-"), U8("."), U8("/"), U8("0"),
                 //       49   50   51   52   53   54   55   56   57   58   59   60   61   62   63   64
-                "1", "2", "3", "4", "5", "6", "7", "8", "9", ":", ";", "<", "=", ">", "?", "@",
+                U8("1"), U8("2"), U8("3"), U8("4"), U8("5"), U8("6"), U8("7"), U8("8"), U8("9"), U8(":"), U8(";"), U8("<"), U8("="), U8(">"), U8("?"), U8("@"),
                 //       65   66   67   68   69   70   71   72   73   74   75   76   77   78   79   80
-                "A", "B", "C", "D", "E", "F", "G", "H", "I", "J", "K", "L", "M", "N", "O", "P",
+                U8("A"), U8("B"), U8("C"), U8("D"), U8("E"), U8("F"), U8("G"), U8("H"), U8("I"), U8("J"), U8("K"), U8("L"), U8("M"), U8("N"), U8("O"), U8("P"),
                 //       81   82   83   84   85   86   87   88   89   90   91   92   93   94   95   96
-                "Q", "R", "S", "T", "U", "V", "W", "X", "Y", "Z", "[", "\\","]", "^", "_", "`",
+                U8("Q"), U8("R"), U8("S"), U8("T"), U8("U"), U8("V"), U8("W"), U8("X"), U8("Y"), U8("Z"), U8("["), U8("\\"),U8("]"), U8("^"), U8("_"), U8("`"),
                 //       97   98   99   100  101  102  103  104  105  106  107  108  109  110  111  112
-                "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o", "p",
+                U8("a"), U8("b"), U8("c"), U8("d"), U8("e"), U8("f"), U8("g"), U8("h"), U8("i"), U8("j"), U8("k"), U8("l"), U8("m"), U8("n"), U8("o"), U8("p"),
                 //       113  114  115  116  117  118  119  120  121  122  123  124  125  126
-                "q", "r", "s", "t", "u", "v", "w", "x", "y", "z", "{", "|", "}", "~"
+                U8("q"), U8("r"), U8("s"), U8("t"), U8("u"), U8("v"), U8("w"), U8("x"), U8("y"), U8("z"), U8("{"), U8("|"), U8("}"), U8("~")
         }
 };
 
-static  gboolean    bAbsolutePoint = TRUE;
-
 void
 initializeHPGL( tGlobal *pGlobal, gboolean bLandscape ) {
 
@@ -190,392 +197,1042 @@ initializeHPGL( tGlobal *pGlobal, gboolean bLandscape ) {
         pGlobal->aspectRatio = 1.0 / sqrt( 2.0 );
     }
 
-    bAbsolutePoint = TRUE;
+    if( pGlobal->pHPGLparser )
+        pGlobal->pHPGLparser->bAbsolutePoint = TRUE;
+}
+
+#define COMPILED_HPGL_MIN_ALLOCATION   (64 * 1024)
+
+/*!     \brief  Lock compiled HPGL that is shared with other threads
+ *
+ * The plot (pGlobal->plotHPGL) is added to by the GPIB thread while it is
+ * copied by others. The GPIB thread is its only writer (HPGL compiled on the
+ * main loop is handed to it with a TG_ADD_PLOT message). The writer only takes the lock to move the data (when the
+ * buffer grows), to empty it and to change complete; the bytes after complete
+ * are written without it, as no reader looks at them. A reader holds the lock
+ * while it reads complete and copies the data up to it.
+ * Compiled HPGL that is not shared has no lock and this does nothing.
+ *
+ * \param pCompiledHPGL : pointer to the compiled HPGL
+ */
+void
+lockCompiledHPGL( tCompiledHPGL *pCompiledHPGL ) {
+    if( pCompiledHPGL->pMutex )
+        g_mutex_lock( pCompiledHPGL->pMutex );
+}
+
+/*!     \brief  Unlock compiled HPGL (see lockCompiledHPGL())
+ *
+ * \param pCompiledHPGL : pointer to the compiled HPGL
+ */
+void
+unlockCompiledHPGL( tCompiledHPGL *pCompiledHPGL ) {
+    if( pCompiledHPGL->pMutex )
+        g_mutex_unlock( pCompiledHPGL->pMutex );
+}
+
+/*!     \brief  Make room for more compiled HPGL
+ *
+ * The buffer grows geometrically, so the cost of growing is spread over many appends.
+ * The data may move, so keep offsets (not pointers) into the compiled HPGL.
+ *
+ * \param pCompiledHPGL : pointer to the compiled HPGL
+ * \param size          : number of bytes that will be added
+ * \return pointer to where the bytes are to be added
+ */
+guchar *
+reserveCompiledHPGL( tCompiledHPGL *pCompiledHPGL, gsize size ) {
+    if( pCompiledHPGL->length + size > pCompiledHPGL->allocated ) {
+        gsize allocated = MAX( pCompiledHPGL->allocated, COMPILED_HPGL_MIN_ALLOCATION );
+        while( allocated < pCompiledHPGL->length + size )
+            allocated *= 2;
+        // not while another thread is copying it
+        lockCompiledHPGL( pCompiledHPGL );
+        pCompiledHPGL->data = g_realloc( pCompiledHPGL->data, allocated );
+        pCompiledHPGL->allocated = allocated;
+        unlockCompiledHPGL( pCompiledHPGL );
+    }
+    return pCompiledHPGL->data + pCompiledHPGL->length;
+}
+
+/*!     \brief  Mark everything compiled so far as whole commands (that may be drawn)
+ *
+ * \param pCompiledHPGL : pointer to the compiled HPGL
+ */
+void
+completeCompiledHPGL( tCompiledHPGL *pCompiledHPGL ) {
+    lockCompiledHPGL( pCompiledHPGL );
+    pCompiledHPGL->complete = pCompiledHPGL->length;
+    unlockCompiledHPGL( pCompiledHPGL );
 }
 
-static gchar labelTerminator = '\003';
+/*!     \brief  Empty the compiled HPGL (keeping the memory for reuse)
+ *
+ * The generation is changed so that anything drawn from it can tell it is a new plot.
+ *
+ * \param pCompiledHPGL : pointer to the compiled HPGL
+ */
+void
+clearCompiledHPGL( tCompiledHPGL *pCompiledHPGL ) {
+    lockCompiledHPGL( pCompiledHPGL );
+    pCompiledHPGL->length = pCompiledHPGL->complete = 0;
+    pCompiledHPGL->generation++;
+    unlockCompiledHPGL( pCompiledHPGL );
+}
 
+/*!     \brief  Free the memory of the compiled HPGL
+ *
+ * \param pCompiledHPGL : pointer to the compiled HPGL
+ */
 void
-append( void **pCompiledHPGL, guint *countOfBytes, eHPGL HPGLfn, void *pObject, size_t size ){
+freeCompiledHPGL( tCompiledHPGL *pCompiledHPGL ) {
+    lockCompiledHPGL( pCompiledHPGL );
+    g_free( pCompiledHPGL->data );
+    pCompiledHPGL->data = NULL;
+    pCompiledHPGL->length = pCompiledHPGL->allocated = pCompiledHPGL->complete = 0;
+    pCompiledHPGL->generation++;
+    unlockCompiledHPGL( pCompiledHPGL );
+}
 
-    // We may not need all this space, but ... just in case
-    // We quantize so as to minimize the number of reallocs (glib probably does this too)
-    *pCompiledHPGL = g_realloc( *pCompiledHPGL,
-            QUANTIZE( *countOfBytes + size + sizeof( eHPGL ) + sizeof( tCoord ) + sizeof(gchar), 1000 ) );
+/*!     \brief  Add a CHPGL byte and/or its payload to the compiled HPGL
+ *
+ * \param pCompiledHPGL : pointer to the compiled HPGL
+ * \param HPGLfn        : CHPGL byte (PAYLOAD_ONLY if just adding to the payload)
+ * \param pObject       : pointer to the payload
+ * \param size          : size of the payload
+ */
+static inline void
+append( tCompiledHPGL *pCompiledHPGL, eHPGL HPGLfn, const void *pObject, gsize size ) {
+    guchar *pData = reserveCompiledHPGL( pCompiledHPGL, size + CHPGL_OPCODE_SIZE );
 
     if( HPGLfn != PAYLOAD_ONLY ) {
-        *(eHPGL *)(*pCompiledHPGL + *countOfBytes) = HPGLfn;
-        *countOfBytes  += sizeof( eHPGL );
+        *pData = HPGLfn;
+        pData += CHPGL_OPCODE_SIZE;
     }
-    memcpy( *pCompiledHPGL + *countOfBytes, pObject, size );
-    *countOfBytes += size;
+    memcpy( pData, pObject, size );
+    pCompiledHPGL->length = pData + size - pCompiledHPGL->data;
 }
 
+/*!     \brief  Forget the HPGL received (kept for saving)
+ *
+ * \param pGlobal       : pointer to global data
+ */
 void
-clearHPGL( tGlobal *pGlobal ) {
-    g_free( pGlobal->plotHPGL );
-    pGlobal->plotHPGL = 0;
+clearVerbatimHPGL( tGlobal *pGlobal ) {
     if ( pGlobal->verbatimHPGLplot )
         g_string_free( pGlobal->verbatimHPGLplot, TRUE );
     pGlobal->verbatimHPGLplot = NULL;
     gtk_widget_set_sensitive( WLOOKUP( pGlobal, "btn_SaveHPGL" ), FALSE );
 }
 
+/*!     \brief  Clear the plot (on the GPIB thread .. see addToPlotOnGPIBthread() for the main loop)
+ *
+ * \param pGlobal       : pointer to global data
+ */
+void
+clearHPGL( tGlobal *pGlobal ) {
+    clearCompiledHPGL( &pGlobal->plotHPGL );
+    clearVerbatimHPGL( pGlobal );
+}
+
+/*!     \brief  Add one compiled HPGL plot to the end of another
+ *
+ * The compiled plot is a serial stream, so a plot compiled separately
+ * (i.e. a recalled file) can be tacked on to the end of the current plot.
+ *
+ * \param pCompiledHPGL     : pointer to the compiled HPGL to add to
+ * \param pCompiledHPGLmore : compiled HPGL to add (this is emptied and freed)
+ */
+void
+appendCompiledHPGL( tCompiledHPGL *pCompiledHPGL, tCompiledHPGL *pCompiledHPGLmore ) {
+    if( pCompiledHPGL->length == 0 ) {
+        // nothing to add to .. just take the other buffer (it is still the same plot)
+        lockCompiledHPGL( pCompiledHPGL );
+        tCompiledHPGL empty = *pCompiledHPGL;
+        *pCompiledHPGL = *pCompiledHPGLmore;
+        pCompiledHPGL->generation = empty.generation;
+        pCompiledHPGL->pMutex = empty.pMutex;
+        pCompiledHPGL->complete = pCompiledHPGL->length;
+        empty.pMutex = pCompiledHPGLmore->pMutex;
+        *pCompiledHPGLmore = empty;
+        unlockCompiledHPGL( pCompiledHPGL );
+    } else if( pCompiledHPGLmore->length > 0 ) {
+        memcpy( reserveCompiledHPGL( pCompiledHPGL, pCompiledHPGLmore->length ),
+                pCompiledHPGLmore->data, pCompiledHPGLmore->length );
+        pCompiledHPGL->length += pCompiledHPGLmore->length;
+    }
+    completeCompiledHPGL( pCompiledHPGL );
+    freeCompiledHPGL( pCompiledHPGLmore );
+}
+
+/*!     \brief  Step over a command in the compiled HPGL
+ *
+ * \param plotHPGL  : the compiled HPGL
+ * \param at        : offset of a command (its CHPGL byte)
+ * \return offset of the command after it
+ */
+gsize
+nextCompiledHPGL( const guchar *plotHPGL, gsize at ) {
+    eHPGL cmd = plotHPGL[ at ];
+    eHPGLscalingType scaleType;
+    guint16 count, runLength;
+
+    at += CHPGL_OPCODE_SIZE;
+    switch( cmd ) {
+    case CHPGL_MOVE:
+    case CHPGL_RMOVE:
+        return at + sizeof( tCoord );
+    case CHPGL_PEN:
+    case CHPGL_LINETYPE:
+        return at + sizeof( guint8 );
+    case CHPGL_TEXT_SIZE:
+        return at + 2 * sizeof( gfloat );
+    case CHPGL_OP:
+    case CHPGL_IP:
+        return at + 2 * sizeof( tCoord );
+    case CHPGL_ROTATION:
+        return at + sizeof( gint );
+    case CHPGL_SCALING:
+        memcpy( &scaleType, plotHPGL + at, sizeof( eHPGLscalingType ) );
+        at += sizeof( eHPGLscalingType );
+        if( scaleType != SCALING_NONE )
+            at += 2 * sizeof( tCoord );
+        if( scaleType == SCALING_ISOTROLIC_LB )
+            at += sizeof( tCoord );
+        return at;
+    case CHPGL_UCHAR:
+        memcpy( &count, plotHPGL + at, sizeof( guint16 ) );
+        return at + sizeof( guint16 ) + count * sizeof( tCoordFloat );
+    case CHPGL_POLYLINE:
+    case CHPGL_RPOLYLINE:
+        memcpy( &count, plotHPGL + at, sizeof( guint16 ) );
+        return at + sizeof( guint16 ) + count * sizeof( tCoord );
+    case CHPGL_LABEL:
+        memcpy( &count, plotHPGL + at, sizeof( guint16 ) );
+        at += sizeof( guint16 );
+        for( ; count > 0; count-- ) {
+            memcpy( &runLength, plotHPGL + at + sizeof( guint8 ), sizeof( guint16 ) );
+            at += sizeof( guint8 ) + sizeof( guint16 ) + runLength + 1;
+        }
+        return at;
+    default:    // CHPGL_PEN_UP, CHPGL_PEN_DOWN
+        return at;
+    }
+}
+
+/*!     \brief  Create a parser for an HPGL stream
+ *
+ * All the state needed to parse a stream of HPGL (the modal state of the
+ * plotter and any partially received command) is held in the parser, so
+ * several streams may be parsed at once (on different threads).
+ *
+ * \param pCompiledHPGL        : pointer to the compiled HPGL that the parser adds to
+ * \param bReplyToInstrument   : answer output commands (OE, OP, OS) over GPIB
+ * \param pGlobal              : pointer to global data
+ * \return pointer to the parser (free with freeHPGLparser)
+ */
+tHPGLParser *
+newHPGLparser( tCompiledHPGL *pCompiledHPGL, gboolean bReplyToInstrument, tGlobal *pGlobal ) {
+    tHPGLParser *pParser = g_new0( tHPGLParser, 1 );
+
+    pParser->HPGLcmdArgs = g_string_new( NULL );
+    pParser->label = g_string_new( NULL );
+    pParser->pCompiledHPGL = pCompiledHPGL;
+    pParser->flags.bReplyToInstrument = bReplyToInstrument;
+    pParser->pGlobal = pGlobal;
+    resetHPGLparser( pParser );
+
+    return pParser;
+}
+
+/*!     \brief  Free a parser created with newHPGLparser
+ *
+ * The compiled HPGL is not touched.
+ *
+ * \param pParser : pointer to the parser
+ */
+void
+freeHPGLparser( tHPGLParser *pParser ) {
+    if( pParser == NULL )
+        return;
+    g_string_free( pParser->HPGLcmdArgs, TRUE );
+    g_string_free( pParser->label, TRUE );
+    g_free( pParser );
+}
+
+/*!     \brief  Return the parser to the power on state
+ *
+ * Any partially received command is discarded.
+ *
+ * \param pParser : pointer to the parser
+ */
+void
+resetHPGLparser( tHPGLParser *pParser ) {
+    pParser->HPGLcmd = 0;
+    g_string_truncate( pParser->HPGLcmdArgs, 0 );
+    pParser->labelTerminator = HPGL_LINE_TERMINATOR_CHARACTER;
+    pParser->bAbsolutePoint = TRUE;
+    pParser->bPenParked = FALSE;
+    pParser->charSizeX = pParser->charSizeY = 0.0;
+    pParser->colour = 0;
+    pParser->lineType = 0;
+    pParser->characterSet = 0;
+}
+
+// The modal state of the plotter carried from one piece of a stream to the next
+#define HPGL_MODAL_ABSOLUTE         0x01    // PA / PR
+#define HPGL_MODAL_CHARSET          0x02    // CS
+#define HPGL_MODAL_TERMINATOR       0x04    // DT
+#define HPGL_MODAL_PEN              0x08    // SP
+#define HPGL_MODAL_CHARSIZE         0x10    // SR
+#define HPGL_MODAL_LINETYPE         0x20    // LT
+
+// Note which modal state is set by a parser and which it depends on from what went before
+#define SET_HPGL_MODAL(pParser, modal)  ( (pParser)->modalSet |= (modal) )
+#define USE_HPGL_MODAL(pParser, modal)  ( (pParser)->modalUsed |= (modal) & ~(pParser)->modalSet )
+
+#define MAX_NUMBER_LENGTH           63
+#define IS_NUMBER_CHAR(c)           ( g_ascii_isdigit(c) || (c) == '-' || (c) == '+' || (c) == '.' || (c) == 'e' || (c) == 'E' )
+
+/*!     \brief  Convert a number in an HPGL argument span
+ *
+ * The argument span points into the GPIB (or file) buffer and is not null terminated,
+ * so the number is copied to a small buffer before it is converted.
+ *
+ * \param pNextChar : pointer to the number (leading white space is skipped)
+ * \param pEnd      : end of the argument span
+ * \param pValue    : pointer to the converted value (0.0 if there is no number)
+ * \return pointer to the character following the number
+ */
+static const gchar *
+parseHPGLnumber( const gchar *pNextChar, const gchar *pEnd, gdouble *pValue ) {
+    gchar sNumber[ MAX_NUMBER_LENGTH + 1 ];
+    gchar *pNumberEnd;
+    gint n;
+
+    while( pNextChar < pEnd && g_ascii_isspace( *pNextChar ) )
+        pNextChar++;
+
+    for( n = 0; n < MAX_NUMBER_LENGTH && pNextChar + n < pEnd && IS_NUMBER_CHAR( pNextChar[ n ] ); n++ )
+        sNumber[ n ] = pNextChar[ n ];
+    sNumber[ n ] = 0;
+
+    *pValue = g_ascii_strtod( sNumber, &pNumberEnd );
+    return pNextChar + (pNumberEnd - sNumber);
+}
+
+/*!     \brief  Skip the separators between numbers in an HPGL argument span
+ *
+ * \param pNextChar : pointer into the argument span
+ * \param pEnd      : end of the argument span
+ * \return pointer to the next character that is not white space or a comma
+ */
+static inline const gchar *
+skipHPGLseparators( const gchar *pNextChar, const gchar *pEnd ) {
+    while( pNextChar < pEnd && (g_ascii_isspace(*pNextChar) || *pNextChar == ',') )
+        pNextChar++;
+    return pNextChar;
+}
+
+#define MAX_FAST_DIGITS             9       // no overflow of a gint32
+
+/*!     \brief  Convert an HPGL coordinate
+ *
+ * Instruments almost always send coordinates as plain integers (PD10886,1568,...),
+ * so the digits are converted directly. When at least eight characters remain in
+ * the span, the digits are found and converted eight at a time within a 64 bit word.
+ * Only a number with a fraction or an exponent falls back to parseHPGLnumber()
+ * (and is rounded to the nearest plotter unit).
+ *
+ * \param pNextChar : pointer to the coordinate (leading white space is skipped)
+ * \param pEnd      : end of the argument span
+ * \param pValue    : pointer to the coordinate (0 if there is no number)
+ * \return pointer to the character following the coordinate
+ */
+static const gchar *
+parseHPGLcoordinate( const gchar *pNextChar, const gchar *pEnd, gint32 *pValue ) {
+    const gchar *pNumber;
+    gboolean bNegative = FALSE;
+    gint32 value = 0;
+    gint nDigits = 0;
+    gdouble x;
+
+    while( pNextChar < pEnd && g_ascii_isspace( *pNextChar ) )
+        pNextChar++;
+
+    pNumber = pNextChar;
+    if( pNextChar < pEnd && (*pNextChar == '-' || *pNextChar == '+') )
+        bNegative = (*pNextChar++ == '-');
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+    if( (gsize)(pEnd - pNextChar) >= sizeof( guint64 ) ) {
+        guint64 chars, nonDigits;
+        memcpy( &chars, pNextChar, sizeof( guint64 ) );
+        // the top bit of each byte that is not '0' - '9' is set
+        // (borrows and carries only corrupt the bytes after the first non digit)
+        nonDigits = ((chars - 0x3030303030303030ULL) | (chars + 0x4646464646464646ULL)) & 0x8080808080808080ULL;
+        nDigits = nonDigits ? __builtin_ctzll( nonDigits ) / 8 : (gint)sizeof( guint64 );
+        if( nDigits > 0 ) {
+            // move the digits to the top of the word (the first digit is the most significant)
+            chars = (chars & 0x0F0F0F0F0F0F0F0FULL) << (8 * (sizeof( guint64 ) - nDigits));
+            chars = (chars * 2561) >> 8;                                            // pairs of digits
+            chars = ((chars & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;              // groups of four
+            value = (((chars & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32);  // all eight
+            pNextChar += nDigits;
+        }
+    } else
+#endif
+    {
+        for( ; pNextChar < pEnd && g_ascii_isdigit( *pNextChar ) && nDigits < MAX_FAST_DIGITS; nDigits++ )
+            value = value * 10 + (*pNextChar++ - '0');
+    }
+
+    if( nDigits == 0
+            || (pNextChar < pEnd && (g_ascii_isdigit( *pNextChar )
+                    || *pNextChar == '.' || *pNextChar == 'e' || *pNextChar == 'E')) ) {
+        // not a plain integer (or a very long one)
+        pNextChar = parseHPGLnumber( pNumber, pEnd, &x );
+        *pValue = (gint32)round( x );
+    } else {
+        *pValue = bNegative ? -value : value;
+    }
+    return pNextChar;
+}
+
+#define MORE_HPGL_NUMBERS(p, pEnd)  ( (p) < (pEnd) && (g_ascii_isdigit( *(p) ) || *(p) == '-' || *(p) == '.') )
+
 /*!     \brief  Add points listed as arguments to cammands
  *
  * Commands (PA, PR, UP, DN) may be followed by line points
  * This indicates to move the pen to these points. We capture these movements.
+ * The points are compiled into a single polyline record (count and packed points).
  *
- * \param pGlobal          : pointer to global data
+ * \param pParser          : pointer to the parser
  * \param sXYpoints        : pointer to the command arguments (points)
- * \param pHPGLserialCount : pointer to count of characters in parsed HPGL data
+ * \param argsLength       : length of the command arguments
  * \param bAbsolute        : is the line absolute or relative
  * \return number of points added
  */
 gint
-addLinePoints( tGlobal *pGlobal, gchar *sXYpoints, guint *pHPGLserialCount, gboolean bAbsolute ) {
+addLinePoints( tHPGLParser *pParser, const gchar *sXYpoints, gsize argsLength, gboolean bAbsolute ) {
     gboolean bMorePoints;
-    gchar  *pNextChar;
+    const gchar *pNextChar, *pEnd;
     gint nPoints = 0;
+    guint16 nPolyline = 0;
+    guint nPolylineOffset = 0;
     tCoord p;
 
     pNextChar = sXYpoints;
-    bMorePoints = *pNextChar != 0;
+    pEnd = sXYpoints + argsLength;
+    bMorePoints = pNextChar < pEnd;
 
     while ( bMorePoints ) {
-        gdouble x = g_ascii_strtod( pNextChar, &pNextChar );
-        while( g_ascii_isspace(*pNextChar) || *pNextChar == ',' )
-            pNextChar++;
-        gdouble y = g_ascii_strtod( pNextChar, &pNextChar );
-        while( g_ascii_isspace(*pNextChar) || *pNextChar == ',' )
-            pNextChar++;
-
-        p.x = (gint32)round(x);
-        p.y = (gint32)round(y);
-
-        append( &pGlobal->plotHPGL, pHPGLserialCount,
-                bAbsolute ? CHPGL_MOVE : CHPGL_RMOVE,  &p, sizeof(tCoord)  );
+        const gchar *pPoint = pNextChar;
+        pNextChar = parseHPGLcoordinate( pNextChar, pEnd, &p.x );
+        pNextChar = skipHPGLseparators( pNextChar, pEnd );
+        pNextChar = parseHPGLcoordinate( pNextChar, pEnd, &p.y );
+        pNextChar = skipHPGLseparators( pNextChar, pEnd );
+
+        if( nPolyline == 0 ) {
+            // start a polyline .. the count is a place holder that we update
+            append( pParser->pCompiledHPGL,
+                    bAbsolute ? CHPGL_POLYLINE : CHPGL_RPOLYLINE, &nPolyline, sizeof( guint16 ) );
+            nPolylineOffset = pParser->pCompiledHPGL->length - sizeof( guint16 );
+        }
+        append( pParser->pCompiledHPGL, PAYLOAD_ONLY, &p, sizeof(tCoord) );
+        nPolyline++;
+        nPoints++;
 
-        if( !(g_ascii_isdigit( *pNextChar ) || *pNextChar == '-' || *pNextChar == '.' ))
+        // stop if there are no more numbers (or we could not make sense of them e.g. "PA-;")
+        if( !MORE_HPGL_NUMBERS( pNextChar, pEnd ) || pNextChar == pPoint )
             bMorePoints = FALSE;
 
-        nPoints++;
+        if( !bMorePoints || nPolyline == CHPGL_MAX_POLYLINE ) {
+            memcpy( pParser->pCompiledHPGL->data + nPolylineOffset, &nPolyline, sizeof( guint16 ) );
+            nPolyline = 0;
+        }
     }
     return nPoints;
 
 }
 
-/*!     \brief  Parse an HPGL command
+#define MAX_NUMERIC_ARGS_LENGTH     127
+
+/*!     \brief  Copy the arguments of a command to a null terminated string
+ *
+ * Commands with a few numeric arguments are decoded with sscanf, which
+ * needs a null terminated (and, for COMMA2SPACE, writable) string.
+ *
+ * \param sArgs      : buffer of at least MAX_NUMERIC_ARGS_LENGTH+1 characters
+ * \param sHPGLargs  : pointer to the command arguments
+ * \param argsLength : length of the command arguments
+ * \return sArgs
+ */
+static gchar *
+argsToString( gchar *sArgs, const gchar *sHPGLargs, gsize argsLength ) {
+    argsLength = MIN( argsLength, MAX_NUMERIC_ARGS_LENGTH );
+    memcpy( sArgs, sHPGLargs, argsLength );
+    sArgs[ argsLength ] = 0;
+    return sArgs;
+}
+
+/*
+ * The compiled HPGL
  *
- * Parse an HPGL command and prepare data for plotting.
  * We create a compiled serial data set for (a little more) efficient plotting....
  * (we replot every time the window is enlarged or reduced, so making a little faster is helpful)
- * NNNNNNNN - byte count (total count of bytes for the data)
- * Line         - CHPGL_LINE2PT - identifier byte
- *                NN          - 16 bit count of bytes in line (n)
- *                NN          - 16 bit x1 position
- *                NN          - 16 bit y1 position
- *                x & y repeated for coordinate 2 to n (min of three points)
- * 2 point Line - CHPGL_LINE2PT - identifier byte
- *                NN          - 16 bit x1 position
- *                NN          - 16 bit y1 position
- *                NN          - 16 bit x2 position
- *                NN          - 16 bit y2 position
- * label        - CHPGL_LABEL or CHPGL_LABEL_REL - identifier byte
- *                NN          - 16 bit x position
- *                NN          - 16 bit y position
- *                NN          - 16 bit byte count of string (including trailling null)
- *                SSSSSSS.... - variable length string (including terminating by NULL)
- * lable size   - HPGL_CHAR_SIZE_REL - identifier byte
+ * polyline     - CHPGL_POLYLINE or CHPGL_RPOLYLINE (relative) - identifier byte
+ *                NN          - 16 bit count of points (n)
+ *                NNNN        - 32 bit x1 position
+ *                NNNN        - 32 bit y1 position
+ *                x & y repeated for points 2 to n
+ * label        - CHPGL_LABEL - identifier byte
+ *                NN          - 16 bit count of runs of text (n)
+ *                N           - 8 bit cursor move following the text of run 1 (eHPGLlabelMove)
+ *                NN          - 16 bit byte count of the text of run 1 (not including the trailing null)
+ *                SSSSSSS.... - variable length text of run 1 (terminated by a null)
+ *                move, count & text repeated for runs 2 to n (the move of the last is LABEL_END
+ *                unless the label ends with a cursor move)
+ * label size   - CHPGL_TEXT_SIZE - identifier byte
  *                NNNN        - float character size scaling in x (percentage of P2-P1 x)
- *                NNNN        - float character size scaling in y (percentahge of P2-P1 y)
+ *                NNNN        - float character size scaling in y (percentage of P2-P1 y)
  * pen select   - HPGL_SELECT_PEN - identifier byte
  *                N           - 8 bits identifying the pen (colour)
  * line type    - HPGL_LINE_TYPE - identifier byte
  *                N           - 8 bits identifying the line type (AFAICT this does not change)
  *
- *
- * \param  sHPGL	pointer to HPGL snippet
- * \return 0 (OK) or -1 (ERROR)
+ * Each HPGL command has a handler below. The handlers are called with the
+ * arguments of the command (a span of the input buffer, not null terminated)
+ * and add to the compiled HPGL of the parser.
  */
-gboolean
-parseHPGLcmd( guint16 HPGLcmd, gchar *sHPGLargs, tGlobal *pGlobal ) {
-    static gfloat charSizeX = 0.0, charSizeY = 0.0;
-    static guint8 colour = 0;
-    static guint8 lineType = 0;
-    static gint characterSet = 0;
-    gboolean bMorePoints;
-    gchar  *pNextChar;
-    // If a line is started .. we add to it
-
-    gint   nargs, arg1, arg2, arg3, arg4, arg5, arg6, arg7;
+typedef void (*tHPGLcmdHandler)( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength );
 
-    tCoord pointP1, pointP2, pointLeftBottom;
-    eHPGLscalingType scalingType;
-
-    static gboolean bPenParked = FALSE;			// this often indicate the end of a plot
+// PA (position absolute)
+static void
+HPGLcmd_PA( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    SET_HPGL_MODAL( pParser, HPGL_MODAL_ABSOLUTE );
+    addLinePoints( pParser, sHPGLargs, argsLength, pParser->bAbsolutePoint = TRUE );
+}
 
-    gchar *sReply = 0;
+// PR (position relative)
+static void
+HPGLcmd_PR( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    SET_HPGL_MODAL( pParser, HPGL_MODAL_ABSOLUTE );
+    addLinePoints( pParser, sHPGLargs, argsLength, pParser->bAbsolutePoint = FALSE );
+}
 
-    // number of bytes used in the malloced memory
-    guint HPGLserialCount;
-    guint16 strLength;
+// IN (initialize)
+static void
+HPGLcmd_IN( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    SET_HPGL_MODAL( pParser, HPGL_MODAL_ABSOLUTE );
+    pParser->bAbsolutePoint = TRUE;
+}
 
+// DT (define label terminator)
+static void
+HPGLcmd_DT( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    if( argsLength == 0 )
+        return;
+    SET_HPGL_MODAL( pParser, HPGL_MODAL_TERMINATOR );
+    pParser->labelTerminator = *sHPGLargs;
+}
 
-    if( pGlobal->plotHPGL )
-        HPGLserialCount = *(guint *)(pGlobal->plotHPGL);
-    else
-        HPGLserialCount = sizeof( guint );	// byte count at the beginning of malloced string
+// Label characters the plotter does nothing with (see HP7475A Interfacing & Programming Manual
+// (C8 7475 ASCII Code Definitions)
+#define IS_LABEL_NOP(c)     ( ((c) >= 4 && (c) <= 7) || ((c) >= 16 && (c) <= 31) || (c) == 1 || (c) == 2 )
+// Label characters that move the cursor (the text is shown in runs between them)
+#define IS_LABEL_MOVE(c)    ( (c) == LABEL_LINE_FEED || (c) == LABEL_BACKSPACE || (c) == LABEL_REVERSE_LINE_FEED )
 
-    switch( HPGLcmd ) {
-    case HPGL_POSN_ABS:	// PA
-        addLinePoints( pGlobal, sHPGLargs, &HPGLserialCount, bAbsolutePoint = TRUE );
-        break;
+/*!     \brief  Tidy a (translated) label in place, ready to be shown
+ *
+ * The composite zero stroke ("0<BS>/") is replaced with a zero and the NOPs are removed.
+ * The label ends at a null (if there is one).
+ *
+ * \param sLabel      : the label
+ * \param length      : length of the label
+ * \return the length of the tidied label
+ */
+static gsize
+tidyLabel( gchar *sLabel, gsize length ) {
+    gsize i, j;
+    gchar *pNull = memchr( sLabel, 0, length );
+
+    if( pNull )
+        length = pNull - sLabel;
+
+    for( i = 0, j = 0; i < length; i++ ) {
+        sLabel[ j++ ] = sLabel[ i ];
+        if( sLabel[ i ] == '0' && i + 2 < length && sLabel[ i+1 ] == '\b' && sLabel[ i+2 ] == '/' )
+            i += 2;
+    }
+    length = j;
 
-    case HPGL_POSN_REL:	// PR
-        // We accumulate points in the currentLine malloced array while the pen is down.
-        // When the pen is lifted (PU), we add this sequence of points to the compiled plot
+    for( i = 0, j = 0; i < length; i++ ) {
+        guchar c = sLabel[ i ];
+        if( !IS_LABEL_NOP( c ) )
+            sLabel[ j++ ] = c;
+    }
+    // the length of each run is held in a guint16 (keep whole characters)
+    if( j > G_MAXUINT16 )
+        j = g_utf8_find_prev_char( sLabel, sLabel + G_MAXUINT16 + 1 ) - sLabel;
+    sLabel[ j ] = 0;
 
-        addLinePoints( pGlobal, sHPGLargs, &HPGLserialCount, bAbsolutePoint = FALSE );
-        break;
+    return j;
+}
 
-    case HPGL_INITIALIZE: // PR
-        bAbsolutePoint = TRUE;
-        break;
+/*!     \brief  Find the end of a run of label text
+ *
+ * \param pRun   : start of the run
+ * \param pEnd   : end of the label
+ * \return pointer to the cursor move character ending the run (or pEnd)
+ */
+static const gchar *
+findLabelMove( const gchar *pRun, const gchar *pEnd ) {
+    while( pRun < pEnd && !IS_LABEL_MOVE( *pRun ) )
+        pRun++;
+    return pRun;
+}
 
-    case HPGL_DEF_TERMINATOR:
-        if( *sHPGLargs == 0 )
-            break;
-        labelTerminator = *sHPGLargs;
-        break;
-    case HPGL_LABEL:	// LB
-        strLength = strlen( sHPGLargs );
-        if( strLength == 0 )
-            break;	// don't bother adding null labels ("LB;")
-        {
-            GString *unicodeString = g_string_new( NULL );
-            guint16 unicodeSize;
-            for( int i=0; i < strLength; i++ ) {
-                gchar c = sHPGLargs[i];
-                if( c >= 33 && c <= 126 )
-                    g_string_append( unicodeString, codeSets7475A[ characterSet ][ (gint)c - 33 ] );
-                else
-                    g_string_append_c( unicodeString, c );
-            }
-            unicodeSize = unicodeString->len;
-            append( &pGlobal->plotHPGL, &HPGLserialCount, CHPGL_LABEL, NULL, 0  );
-            // Length of string
-            append( &pGlobal->plotHPGL, &HPGLserialCount, PAYLOAD_ONLY, &unicodeSize, sizeof(guint16)  );
-            // The string (and the trailing null)
-            append( &pGlobal->plotHPGL, &HPGLserialCount, PAYLOAD_ONLY, unicodeString->str, unicodeString->len+1  );
-            g_string_free( unicodeString, TRUE );
+// LB (label)
+static void
+HPGLcmd_LB( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    tCompiledHPGL *pCompiledHPGL = pParser->pCompiledHPGL;
+
+    if( argsLength == 0 )
+        return;	// don't bother adding null labels ("LB;")
+    USE_HPGL_MODAL( pParser, HPGL_MODAL_CHARSET );
+
+    const tCodeSetChar *codeSet = codeSets7475A[ pParser->characterSet ];
+    gchar *pLabel;
+    gsize labelLength;
+
+    // Room for every character to be the longest (and for copying whole table entries)
+    g_string_set_size( pParser->label, (argsLength + 1) * sizeof( tCodeSetChar ) );
+    pLabel = pParser->label->str;
+    for( gsize i=0; i < argsLength; i++ ) {
+        guchar c = sHPGLargs[i];
+        if( c >= 33 && c <= 126 ) {
+            memcpy( pLabel, &codeSet[ c - 33 ], sizeof( tCodeSetChar ) );
+            pLabel += codeSet[ c - 33 ].length;
+        } else {
+            *pLabel++ = c;
         }
+    }
+    *pLabel = 0;
+    labelLength = tidyLabel( pParser->label->str, pLabel - pParser->label->str );
+
+    // count the runs of text between cursor moves
+    const gchar *pRun, *pEnd = pParser->label->str + labelLength, *pMove;
+    guint16 nRuns = 0;
+    for( pRun = pParser->label->str; pRun < pEnd; pRun = pMove + 1 ) {
+        nRuns++;
+        if( (pMove = findLabelMove( pRun, pEnd )) == pEnd )
+            break;
+    }
+    if( nRuns == 0 )
+        return;	// nothing left to show
+
+    append( pCompiledHPGL, CHPGL_LABEL, &nRuns, sizeof( guint16 ) );
+    for( pRun = pParser->label->str; pRun < pEnd; pRun = pMove + 1 ) {
+        guint8 move;
+        guint16 runLength;
+
+        pMove = findLabelMove( pRun, pEnd );
+        move = pMove < pEnd ? *pMove : LABEL_END;
+        runLength = pMove - pRun;
+        append( pCompiledHPGL, PAYLOAD_ONLY, &move, sizeof( guint8 ) );
+        append( pCompiledHPGL, PAYLOAD_ONLY, &runLength, sizeof( guint16 ) );
+        // The text of the run (and a trailing null)
+        memcpy( reserveCompiledHPGL( pCompiledHPGL, runLength + 1 ), pRun, runLength );
+        pCompiledHPGL->data[ pCompiledHPGL->length + runLength ] = 0;
+        pCompiledHPGL->length += runLength + 1;
+        if( move == LABEL_END )
+            break;
+    }
+}
 
-        break;
+// PU (pen up)
+static void
+HPGLcmd_PU( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    append( pParser->pCompiledHPGL, CHPGL_PEN_UP,  NULL, 0  );
+    USE_HPGL_MODAL( pParser, HPGL_MODAL_ABSOLUTE );
+    addLinePoints( pParser, sHPGLargs, argsLength, pParser->bAbsolutePoint );
+}
 
-    case HPGL_PEN_UP:	// PU
-        append( &pGlobal->plotHPGL, &HPGLserialCount, CHPGL_PEN_UP,  NULL, 0  );
-        addLinePoints( pGlobal, sHPGLargs, &HPGLserialCount, bAbsolutePoint );
-        break;
+// PD (pen down)
+static void
+HPGLcmd_PD( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    append( pParser->pCompiledHPGL, CHPGL_PEN_DOWN,  NULL, 0  );
+    USE_HPGL_MODAL( pParser, HPGL_MODAL_ABSOLUTE );
+    addLinePoints( pParser, sHPGLargs, argsLength, pParser->bAbsolutePoint );
+}
 
-    case HPGL_PEN_DOWN:	// PD
-        append( &pGlobal->plotHPGL, &HPGLserialCount, CHPGL_PEN_DOWN,  NULL, 0  );
-        addLinePoints( pGlobal, sHPGLargs, &HPGLserialCount, bAbsolutePoint );
-        break;
+// SR (character size relative)
+static void
+HPGLcmd_SR( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    gchar  sNumericArgs[ MAX_NUMERIC_ARGS_LENGTH+1 ], *sArgs;
+
+    SET_HPGL_MODAL( pParser, HPGL_MODAL_CHARSIZE );
+    sArgs = argsToString( sNumericArgs, sHPGLargs, argsLength );
+    COMMA2SPACE( sArgs );
+    pParser->charSizeX = 0.75;
+    pParser->charSizeY = 1.5;
+    sscanf(sArgs, "%f %f", &pParser->charSizeX, &pParser->charSizeY);
+    // add the text size change to the compiled HPGL serialized string
+    append( pParser->pCompiledHPGL, CHPGL_TEXT_SIZE,  &pParser->charSizeX, sizeof( gfloat)  );
+    append( pParser->pCompiledHPGL, PAYLOAD_ONLY,     &pParser->charSizeY, sizeof( gfloat)  );
+}
 
-    case HPGL_CHAR_SIZE_REL:	// SR
-        COMMA2SPACE( sHPGLargs );
-        charSizeX = 0.75;
-        charSizeY = 1.5;
-        sscanf(sHPGLargs, "%f %f", &charSizeX, &charSizeY);
-        // add the text size change to the compiled HPGL serialized string
-        append( &pGlobal->plotHPGL, &HPGLserialCount, CHPGL_TEXT_SIZE,  &charSizeX, sizeof( gfloat)  );
-        append( &pGlobal->plotHPGL, &HPGLserialCount, PAYLOAD_ONLY,     &charSizeY, sizeof( gfloat)  );
-        break;
+// LT (line type)
+static void
+HPGLcmd_LT( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    gchar  sNumericArgs[ MAX_NUMERIC_ARGS_LENGTH+1 ];
 
-    case HPGL_LINE_TYPE:	// LT
-        lineType = 0;
-        sscanf(sHPGLargs, "%"SCNu8, &lineType);
-        append( &pGlobal->plotHPGL, &HPGLserialCount, CHPGL_LINETYPE,  &lineType, sizeof( guint8 )  );
-        break;
+    SET_HPGL_MODAL( pParser, HPGL_MODAL_LINETYPE );
+    pParser->lineType = 0;
+    sscanf(argsToString( sNumericArgs, sHPGLargs, argsLength ), "%"SCNu8, &pParser->lineType);
+    append( pParser->pCompiledHPGL, CHPGL_LINETYPE,  &pParser->lineType, sizeof( guint8 )  );
+}
+
+// SP (select pen)
+static void
+HPGLcmd_SP( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    gchar  sNumericArgs[ MAX_NUMERIC_ARGS_LENGTH+1 ];
 
-    case HPGL_SELECT_PEN:	// SP
-        colour = 0;		// if we have "SP;" without arguments, it equals SP0;
-        sscanf(sHPGLargs, "%"SCNu8, &colour);
+    SET_HPGL_MODAL( pParser, HPGL_MODAL_PEN );
+    pParser->colour = 0;		// if we have "SP;" without arguments, it equals SP0;
+    sscanf(argsToString( sNumericArgs, sHPGLargs, argsLength ), "%"SCNu8, &pParser->colour);
 
-        append( &pGlobal->plotHPGL, &HPGLserialCount, CHPGL_PEN,  &colour, sizeof( guint8 )  );
+    append( pParser->pCompiledHPGL, CHPGL_PEN,  &pParser->colour, sizeof( guint8 )  );
 
-        if( colour == 0 ) {
-            bPenParked = TRUE;
-            pGlobal->flags.bErasePrimed = TRUE;
+    if( pParser->colour == 0 ) {
+        pParser->bPenParked = TRUE;     // this often indicate the end of a plot
+        if( !pParser->flags.bWorker ) {
+            pParser->pGlobal->flags.bErasePrimed = TRUE;
             postInfo("");
-        } else {
-            bPenParked = FALSE;
         }
-        break;
+    } else {
+        pParser->bPenParked = FALSE;
+    }
+}
 
-    case HPGL_INPUT_POINTS:	// IP
-        COMMA2SPACE( sHPGLargs );
-        nargs = sscanf(sHPGLargs, "%d %d %d %d", &arg1, &arg2, &arg3, &arg4);
-        if( nargs == 2 || nargs == 4 ) {
-            gint xdiff = pGlobal->HPGLplotterP1P2[ P2 ].x - pGlobal->HPGLplotterP1P2[ P1 ].x;
-            gint ydiff = pGlobal->HPGLplotterP1P2[ P2 ].y - pGlobal->HPGLplotterP1P2[ P1 ].y;
-            pointP1.x = arg1;
-            pointP1.y = arg2;
-            if( nargs == 2 ) {
-                pointP2.x = arg1 + xdiff;
-                pointP2.y = arg2 + ydiff;
-            } else {
-                pointP2.x = arg3;
-                pointP2.y = arg4;
-            }
+// IP (input P1 & P2)
+static void
+HPGLcmd_IP( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    tGlobal *pGlobal = pParser->pGlobal;
+    gchar  sNumericArgs[ MAX_NUMERIC_ARGS_LENGTH+1 ], *sArgs;
+    gint   nargs, arg1, arg2, arg3, arg4;
+    tCoord pointP1, pointP2;
+
+    sArgs = argsToString( sNumericArgs, sHPGLargs, argsLength );
+    COMMA2SPACE( sArgs );
+    nargs = sscanf(sArgs, "%d %d %d %d", &arg1, &arg2, &arg3, &arg4);
+    if( nargs == 2 || nargs == 4 ) {
+        gint xdiff = pGlobal->HPGLplotterP1P2[ P2 ].x - pGlobal->HPGLplotterP1P2[ P1 ].x;
+        gint ydiff = pGlobal->HPGLplotterP1P2[ P2 ].y - pGlobal->HPGLplotterP1P2[ P1 ].y;
+        pointP1.x = arg1;
+        pointP1.y = arg2;
+        if( nargs == 2 ) {
+            pointP2.x = arg1 + xdiff;
+            pointP2.y = arg2 + ydiff;
         } else {
-            pointP1 = pGlobal->HPGLplotterP1P2[ P1 ];
-            pointP2 = pGlobal->HPGLplotterP1P2[ P2 ];
+            pointP2.x = arg3;
+            pointP2.y = arg4;
         }
-        append( &pGlobal->plotHPGL, &HPGLserialCount, CHPGL_IP,  &pointP1, sizeof( tCoord)  );
-        append( &pGlobal->plotHPGL, &HPGLserialCount, PAYLOAD_ONLY, &pointP2, sizeof( tCoord)  );
-        break;
+    } else {
+        pointP1 = pGlobal->HPGLplotterP1P2[ P1 ];
+        pointP2 = pGlobal->HPGLplotterP1P2[ P2 ];
+    }
+    append( pParser->pCompiledHPGL, CHPGL_IP,  &pointP1, sizeof( tCoord)  );
+    append( pParser->pCompiledHPGL, PAYLOAD_ONLY, &pointP2, sizeof( tCoord)  );
+}
 
-    case HPGL_ROTATION:
-        nargs = sscanf(sHPGLargs, "%d", &arg1);
-        if( nargs <= 0 )
-            arg1 = 0;
-        append( &pGlobal->plotHPGL, &HPGLserialCount, CHPGL_ROTATION,  &arg1, sizeof( gint )  );
-        break;
+// RO (rotation)
+static void
+HPGLcmd_RO( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    gchar  sNumericArgs[ MAX_NUMERIC_ARGS_LENGTH+1 ];
+    gint   nargs, arg1;
 
-    case HPGL_CHARACTER_SET:
-        nargs = sscanf(sHPGLargs, "%d", &characterSet);
-        if( nargs <= 0 || characterSet >= N_CODE_SETS )
-            characterSet = 0;
-        break;
+    nargs = sscanf(argsToString( sNumericArgs, sHPGLargs, argsLength ), "%d", &arg1);
+    if( nargs <= 0 )
+        arg1 = 0;
+    append( pParser->pCompiledHPGL, CHPGL_ROTATION,  &arg1, sizeof( gint )  );
+}
 
-    case HPGL_SCALING:		// SC
-        COMMA2SPACE( sHPGLargs );
-        nargs = sscanf(sHPGLargs, "%d %d %d %d %d %d %d", &arg1, &arg2, &arg3, &arg4, &arg5, &arg6, &arg7);
+// CS (character set)
+static void
+HPGLcmd_CS( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    gchar  sNumericArgs[ MAX_NUMERIC_ARGS_LENGTH+1 ];
+    gint   nargs;
 
-        if( nargs >= 4 ) {
-            pointP1.x = arg1;
-            pointP2.x = arg2;
-            pointP1.y = arg3;
-            pointP2.y = arg4;
-        }
+    SET_HPGL_MODAL( pParser, HPGL_MODAL_CHARSET );
+    nargs = sscanf(argsToString( sNumericArgs, sHPGLargs, argsLength ), "%d", &pParser->characterSet);
+    if( nargs <= 0 || pParser->characterSet < 0 || pParser->characterSet >= N_CODE_SETS )
+        pParser->characterSet = 0;
+}
 
-        switch( nargs ) {
-        case 0:
-        default:
-            scalingType = SCALING_NONE;
-            append( &pGlobal->plotHPGL, &HPGLserialCount, CHPGL_SCALING, &scalingType, sizeof( eHPGLscalingType )  );
-            break;
-        case 4:
-            scalingType = SCALING_ANISOTROPIC;
-            append( &pGlobal->plotHPGL, &HPGLserialCount, CHPGL_SCALING,  &scalingType, sizeof( eHPGLscalingType )  );
-            append( &pGlobal->plotHPGL, &HPGLserialCount, PAYLOAD_ONLY,  &pointP1, sizeof( tCoord) );
-            append( &pGlobal->plotHPGL, &HPGLserialCount, PAYLOAD_ONLY,  &pointP2, sizeof( tCoord) );
-            break;
-        case 5:
-            scalingType = arg5;
-            append( &pGlobal->plotHPGL, &HPGLserialCount, CHPGL_SCALING,  &scalingType, sizeof( eHPGLscalingType )  );
-            append( &pGlobal->plotHPGL, &HPGLserialCount, PAYLOAD_ONLY,  &pointP1, sizeof( tCoord) );
-            append( &pGlobal->plotHPGL, &HPGLserialCount, PAYLOAD_ONLY,  &pointP2, sizeof( tCoord) );
-            break;
-        case 7:
-            scalingType = SCALING_ISOTROLIC_LB;	// LB is specified only for isotropic
-            pointLeftBottom.x   = arg6;
-            pointLeftBottom.y   = arg7;
-            append( &pGlobal->plotHPGL, &HPGLserialCount, CHPGL_SCALING,  &scalingType, sizeof( eHPGLscalingType )  );
-            append( &pGlobal->plotHPGL, &HPGLserialCount, PAYLOAD_ONLY,  &pointP1, sizeof( tCoord) );
-            append( &pGlobal->plotHPGL, &HPGLserialCount, PAYLOAD_ONLY,  &pointP2, sizeof( tCoord) );
-            append( &pGlobal->plotHPGL, &HPGLserialCount, PAYLOAD_ONLY,  &pointLeftBottom, sizeof( tCoord) );
-            break;
-        }
+// SC (scaling)
+static void
+HPGLcmd_SC( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    tCompiledHPGL *pCompiledHPGL = pParser->pCompiledHPGL;
+    gchar  sNumericArgs[ MAX_NUMERIC_ARGS_LENGTH+1 ], *sArgs;
+    gint   nargs, arg1, arg2, arg3, arg4, arg5, arg6, arg7;
+    tCoord pointP1, pointP2, pointLeftBottom;
+    eHPGLscalingType scalingType;
 
+    sArgs = argsToString( sNumericArgs, sHPGLargs, argsLength );
+    COMMA2SPACE( sArgs );
+    nargs = sscanf(sArgs, "%d %d %d %d %d %d %d", &arg1, &arg2, &arg3, &arg4, &arg5, &arg6, &arg7);
+
+    if( nargs >= 4 ) {
+        pointP1.x = arg1;
+        pointP2.x = arg2;
+        pointP1.y = arg3;
+        pointP2.y = arg4;
+    }
+
+    switch( nargs ) {
+    case 0:
+    default:
+        scalingType = SCALING_NONE;
+        append( pCompiledHPGL, CHPGL_SCALING, &scalingType, sizeof( eHPGLscalingType )  );
+        break;
+    case 4:
+        scalingType = SCALING_ANISOTROPIC;
+        append( pCompiledHPGL, CHPGL_SCALING,  &scalingType, sizeof( eHPGLscalingType )  );
+        append( pCompiledHPGL, PAYLOAD_ONLY,  &pointP1, sizeof( tCoord) );
+        append( pCompiledHPGL, PAYLOAD_ONLY,  &pointP2, sizeof( tCoord) );
+        break;
+    case 5:
+        scalingType = arg5;
+        append( pCompiledHPGL, CHPGL_SCALING,  &scalingType, sizeof( eHPGLscalingType )  );
+        append( pCompiledHPGL, PAYLOAD_ONLY,  &pointP1, sizeof( tCoord) );
+        append( pCompiledHPGL, PAYLOAD_ONLY,  &pointP2, sizeof( tCoord) );
+        break;
+    case 7:
+        scalingType = SCALING_ISOTROLIC_LB;	// LB is specified only for isotropic
+        pointLeftBottom.x   = arg6;
+        pointLeftBottom.y   = arg7;
+        append( pCompiledHPGL, CHPGL_SCALING,  &scalingType, sizeof( eHPGLscalingType )  );
+        append( pCompiledHPGL, PAYLOAD_ONLY,  &pointP1, sizeof( tCoord) );
+        append( pCompiledHPGL, PAYLOAD_ONLY,  &pointP2, sizeof( tCoord) );
+        append( pCompiledHPGL, PAYLOAD_ONLY,  &pointLeftBottom, sizeof( tCoord) );
         break;
+    }
+}
+
+// UC (user character)
+static void
+HPGLcmd_UC( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    tCompiledHPGL *pCompiledHPGL = pParser->pCompiledHPGL;
+    const gchar *pNextChar = sHPGLargs, *pEnd = sHPGLargs + argsLength;
+    gboolean bMorePoints = pNextChar < pEnd;
+
+    if( bMorePoints ){
+        gboolean bPenDown = FALSE;
+        guint16     nPoints = 0;
+        guint       nPointsOffset;
+        tCoordFloat pf;
+        // nPoints is a place holder that we will update
+        // (we keep its offset, as the compiled HPGL may move when it grows)
+        append( pCompiledHPGL, CHPGL_UCHAR,  &nPoints, sizeof(guint16)  );
+        nPointsOffset = pCompiledHPGL->length - sizeof( guint16 );
+
+        pNextChar = skipHPGLseparators( pNextChar, pEnd );
+        while ( bMorePoints ) {
+            const gchar *pPoint = pNextChar;
+            gdouble x, y;
+            pNextChar = parseHPGLnumber( pNextChar, pEnd, &x );
+            pNextChar = skipHPGLseparators( pNextChar, pEnd );
+            if ( x >= 99.0 ) {
+                bPenDown = TRUE;
+            } else if ( x <= -99.0 ){
+                bPenDown = FALSE;
+            } else {
+                pNextChar = parseHPGLnumber( pNextChar, pEnd, &y );
+                pNextChar = skipHPGLseparators( pNextChar, pEnd );
+
+                // not a point if neither number could be made sense of (e.g. "UC-;")
+                if( pNextChar != pPoint ) {
+                    pf.x = (float)x + (bPenDown ? UCPENDOWN_INDICATOR : 0.0);    // this will also indicate if the pen is up/down
+                    pf.y = (float)y;
 
-        case HPGL_USER_CHARACTER:
-            // We accumulate points in the currentLine malloced array while the pen is down.
-            // When the pen is lifted (PU), we add this sequence of points to the compiled plot
-            pNextChar = sHPGLargs;
-            bMorePoints = *pNextChar != 0;
-            if( bMorePoints ){
-                gboolean bPenDown = FALSE;
-                guint16     nDummy = 0;
-                guint16    *pnPoints = &nDummy;
-                tCoordFloat pf;
-                // nPoints is a place holder that we will update
-                append( &pGlobal->plotHPGL, &HPGLserialCount, CHPGL_UCHAR,  &nDummy, sizeof(guint16)  );
-                pnPoints = pGlobal->plotHPGL + HPGLserialCount - sizeof( guint16 );
-
-                while ( bMorePoints ) {
-                    gdouble x = g_ascii_strtod( pNextChar, &pNextChar );
-                    while( g_ascii_isspace(*pNextChar) || *pNextChar == ',' )
-                        pNextChar++;
-                    if ( x >= 99.0 ) {
-                        bPenDown = TRUE;
-                    } else if ( x <= -99.0 ){
-                        bPenDown = FALSE;
-                    } else {
-                        gdouble y = g_ascii_strtod( pNextChar, &pNextChar );
-                        while( g_ascii_isspace(*pNextChar) || *pNextChar == ',' )
-                            pNextChar++;
-
-                        pf.x = (float)x + (bPenDown ? UCPENDOWN_INDICATOR : 0.0);    // this will also indicate if the pen is up/down
-                        pf.y = (float)y;
-
-                        append( &pGlobal->plotHPGL, &HPGLserialCount, PAYLOAD_ONLY,  &pf, sizeof(tCoordFloat)  );
-                        (*pnPoints)++;
-                    }
-                    if( !(g_ascii_isdigit( *pNextChar ) || *pNextChar == '-' || *pNextChar == '.' ))
-                        bMorePoints = FALSE;
+                    append( pCompiledHPGL, PAYLOAD_ONLY,  &pf, sizeof(tCoordFloat)  );
+                    nPoints++;
+                    memcpy( pCompiledHPGL->data + nPointsOffset, &nPoints, sizeof( guint16 ) );
                 }
             }
-            break;
+            // stop if there are no more numbers (or we could not make sense of them)
+            if( !MORE_HPGL_NUMBERS( pNextChar, pEnd ) || pNextChar == pPoint || nPoints == G_MAXUINT16 )
+                bMorePoints = FALSE;
+        }
+    }
+}
 
-        case HPGL_OUTPUT_ERROR:
-            sendGPIBreply( "0\n", pGlobal );	// nothing to see here
-            break;
+// OE (output error)
+static void
+HPGLcmd_OE( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    if( pParser->flags.bReplyToInstrument )
+        sendGPIBreply( "0\n", pParser->pGlobal );	// nothing to see here
+}
+
+// OP (output P1 & P2)
+static void
+HPGLcmd_OP( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    tGlobal *pGlobal = pParser->pGlobal;
+    gchar *sReply = 0;
 
-        case HPGL_OUTPUT_POINTS:
-            postInfo("New plot");
-            sReply = g_strdup_printf( "%d,%d,%d,%d;\n",
-                    pGlobal->HPGLplotterP1P2[ P1 ].x, pGlobal->HPGLplotterP1P2[ P1 ].y,
-                    pGlobal->HPGLplotterP1P2[ P2 ].x, pGlobal->HPGLplotterP1P2[ P2 ].y );
-            sendGPIBreply( sReply, pGlobal );
+    if( !pParser->flags.bWorker )
+        postInfo("New plot");
+    if( pParser->flags.bReplyToInstrument ) {
+        sReply = g_strdup_printf( "%d,%d,%d,%d;\n",
+                pGlobal->HPGLplotterP1P2[ P1 ].x, pGlobal->HPGLplotterP1P2[ P1 ].y,
+                pGlobal->HPGLplotterP1P2[ P2 ].x, pGlobal->HPGLplotterP1P2[ P2 ].y );
+        sendGPIBreply( sReply, pGlobal );
+    }
 #if 0
-            // Erase if we had previously seen a pen park (SR;) command
-            if( pGlobal->flags.bAutoClear  &&
-                    pGlobal->flags.bErasePrimed ) {
-                g_free( pGlobal->plotHPGL );
-                pGlobal->plotHPGL = NULL;
-                HPGLserialCount = sizeof( gint );
-            }
+    // Erase if we had previously seen a pen park (SR;) command
+    if( pGlobal->flags.bAutoClear  &&
+            pGlobal->flags.bErasePrimed ) {
+        clearCompiledHPGL( &pGlobal->plotHPGL );
+    }
 #endif
-            append( &pGlobal->plotHPGL, &HPGLserialCount, CHPGL_OP, &pGlobal->HPGLplotterP1P2[ P1 ], sizeof( tCoord)  );
-            append( &pGlobal->plotHPGL, &HPGLserialCount, PAYLOAD_ONLY, &pGlobal->HPGLplotterP1P2[ P2 ], sizeof( tCoord)  );
+    append( pParser->pCompiledHPGL, CHPGL_OP, &pGlobal->HPGLplotterP1P2[ P1 ], sizeof( tCoord)  );
+    append( pParser->pCompiledHPGL, PAYLOAD_ONLY, &pGlobal->HPGLplotterP1P2[ P2 ], sizeof( tCoord)  );
 
-            g_free( sReply );
-            break;
+    g_free( sReply );
+}
 
-        case HPGL_OUTPUT_STATUS:
-            sendGPIBreply( "26;\n", pGlobal );	// all OK
-            break;
+// OS (output status)
+static void
+HPGLcmd_OS( tHPGLParser *pParser, const gchar *sHPGLargs, gsize argsLength ) {
+    if( pParser->flags.bReplyToInstrument )
+        sendGPIBreply( "26;\n", pParser->pGlobal );	// all OK
+}
 
-        case HPGL_VELOCITY:		// VS
-        case HPGL_INPUT_MASK:	// IM
-        case HPGL_DEFAULT:		// DF
-        case HPGL_PAGE_FEED:	// PG
-        default:
-            break;
-    }
+// The form of the arguments of a command; this tells the tokenizer how to find the end
+// of the arguments and whether they need to be kept at all.
+typedef enum {
+    HPGL_ARGS_IGNORE = 0,   // unsupported (or unknown) command .. the arguments are skipped
+    HPGL_ARGS_NONE,         // no arguments
+    HPGL_ARGS_POINTS,       // list of x,y coordinates
+    HPGL_ARGS_INTEGERS,     // list of integers
+    HPGL_ARGS_NUMBERS,      // list of real numbers
+    HPGL_ARGS_CHARACTER,    // a single character
+    HPGL_ARGS_LABEL         // characters up to the label terminator
+} eHPGLargGrammar;
+
+typedef struct {
+    eHPGLargGrammar grammar;
+    tHPGLcmdHandler handler;
+} tHPGLcommand;
+
+// The registry of HPGL commands; to support another command, add it here (with its handler)
+#define HPGL_COMMAND_REGISTRY( CMD ) \
+    CMD( 'C','S',   HPGL_ARGS_INTEGERS,     HPGLcmd_CS )    /* Character Set            */ \
+    CMD( 'D','F',   HPGL_ARGS_IGNORE,       NULL )          /* Default                  */ \
+    CMD( 'D','T',   HPGL_ARGS_CHARACTER,    HPGLcmd_DT )    /* Define Terminator        */ \
+    CMD( 'I','M',   HPGL_ARGS_IGNORE,       NULL )          /* Input Mask               */ \
+    CMD( 'I','N',   HPGL_ARGS_NONE,         HPGLcmd_IN )    /* Initialize               */ \
+    CMD( 'I','P',   HPGL_ARGS_INTEGERS,     HPGLcmd_IP )    /* Input P1 & P2            */ \
+    CMD( 'L','B',   HPGL_ARGS_LABEL,        HPGLcmd_LB )    /* Label                    */ \
+    CMD( 'L','T',   HPGL_ARGS_INTEGERS,     HPGLcmd_LT )    /* Line Type                */ \
+    CMD( 'O','E',   HPGL_ARGS_NONE,         HPGLcmd_OE )    /* Output Error             */ \
+    CMD( 'O','P',   HPGL_ARGS_NONE,         HPGLcmd_OP )    /* Output P1 & P2           */ \
+    CMD( 'O','S',   HPGL_ARGS_NONE,         HPGLcmd_OS )    /* Output Status            */ \
+    CMD( 'P','A',   HPGL_ARGS_POINTS,       HPGLcmd_PA )    /* Position Absolute        */ \
+    CMD( 'P','D',   HPGL_ARGS_POINTS,       HPGLcmd_PD )    /* Pen Down                 */ \
+    CMD( 'P','G',   HPGL_ARGS_IGNORE,       NULL )          /* Page Feed                */ \
+    CMD( 'P','R',   HPGL_ARGS_POINTS,       HPGLcmd_PR )    /* Position Relative        */ \
+    CMD( 'P','U',   HPGL_ARGS_POINTS,       HPGLcmd_PU )    /* Pen Up                   */ \
+    CMD( 'R','O',   HPGL_ARGS_INTEGERS,     HPGLcmd_RO )    /* Rotation                 */ \
+    CMD( 'S','C',   HPGL_ARGS_INTEGERS,     HPGLcmd_SC )    /* Scaling                  */ \
+    CMD( 'S','P',   HPGL_ARGS_INTEGERS,     HPGLcmd_SP )    /* Select Pen               */ \
+    CMD( 'S','R',   HPGL_ARGS_NUMBERS,      HPGLcmd_SR )    /* Character Size Relative  */ \
+    CMD( 'U','C',   HPGL_ARGS_NUMBERS,      HPGLcmd_UC )    /* User Character           */ \
+    CMD( 'V','S',   HPGL_ARGS_IGNORE,       NULL )          /* Velocity Select          */
+
+// The dispatch table is indexed by the two (upper case) characters of the command.
+// Commands that are not in the registry are zero (HPGL_ARGS_IGNORE with no handler).
+#define HPGL_DISPATCH_ENTRY( c1, c2, argGrammar, cmdHandler ) \
+    [ (c1) - 'A' ][ (c2) - 'A' ] = { .grammar = (argGrammar), .handler = (cmdHandler) },
+
+static const tHPGLcommand HPGLcommands[ 26 ][ 26 ] = {
+    HPGL_COMMAND_REGISTRY( HPGL_DISPATCH_ENTRY )
+};
 
-    // update the count
-    if( pGlobal->plotHPGL )
-        *(guint *)(pGlobal->plotHPGL) = HPGLserialCount;
+/*!     \brief  Look up an HPGL command in the dispatch table
+ *
+ * \param  HPGLcmd     two character command ('X'<<8|'Y')
+ * \return pointer to the dispatch table entry for the command
+ */
+static inline const tHPGLcommand *
+lookupHPGLcmd( guint16 HPGLcmd ) {
+    return &HPGLcommands[ (HPGLcmd >> 8) - 'A' ][ (HPGLcmd & 0xFF) - 'A' ];
+}
 
-    return bPenParked;
+/*!     \brief  Call the handler of an HPGL command
+ *
+ * \param  pParser     pointer to the parser (holding the modal state and compiled HPGL)
+ * \param  pCommand    pointer to the dispatch table entry of the command
+ * \param  sHPGLargs   pointer to the command arguments (not null terminated)
+ * \param  argsLength  length of the command arguments
+ * \return TRUE if the pen has been parked (SP0)
+ */
+static gboolean
+dispatchHPGLcmd( tHPGLParser *pParser, const tHPGLcommand *pCommand, const gchar *sHPGLargs, gsize argsLength ) {
+    if( pCommand->handler )
+        pCommand->handler( pParser, sHPGLargs, argsLength );
+
+    return pParser->bPenParked;
 }
 
-/*
+/*!     \brief  Parse an HPGL command
+ *
+ * Parse an HPGL command and add it to the compiled HPGL of the parser.
+ * The command is dispatched through the table built from the command registry.
+ *
+ * \param  pParser     pointer to the parser (holding the modal state and compiled HPGL)
+ * \param  HPGLcmd     two character command ('X'<<8|'Y')
+ * \param  sHPGLargs   pointer to the command arguments (not null terminated)
+ * \param  argsLength  length of the command arguments
+ * \return TRUE if the pen has been parked (SP0)
+ */
+gboolean
+parseHPGLcmd( tHPGLParser *pParser, guint16 HPGLcmd, const gchar *sHPGLargs, gsize argsLength ) {
+    if( !g_ascii_isupper( HPGLcmd >> 8 ) || !g_ascii_isupper( HPGLcmd & 0xFF ) )
+        return pParser->bPenParked;
+
+    return dispatchHPGLcmd( pParser, lookupHPGLcmd( HPGLcmd ), sHPGLargs, argsLength );
+}
+
+// Classification of the bytes in the HPGL stream.
+// The arguments of a command are found by scanning (with a table lookup) for the
+// terminating class, rather than testing (and copying) each character in turn.
+#define HPGL_CC_COMMAND     0x01    // 'A' - 'Z' may start a two character command
+#define HPGL_CC_TERMINATOR  0x02    // ';' or the start of the next command ends the arguments
+
+static const guint8 HPGLcharClass[ 256 ] = {
+        [ 'A' ... 'Z' ] = HPGL_CC_COMMAND | HPGL_CC_TERMINATOR,
+        [ ';' ]         = HPGL_CC_TERMINATOR
+};
+
+/*!     \brief  Find the next character of a class in the HPGL stream
+ *
+ * \param ptrHPGL   : where to start looking
+ * \param pEnd      : end of the HPGL data
+ * \param charClass : HPGL_CC_COMMAND or HPGL_CC_TERMINATOR
+ * \return pointer to the character found or pEnd if there is none
+ */
+static inline const gchar *
+scanHPGL( const gchar *ptrHPGL, const gchar *pEnd, guint8 charClass ) {
+    while( ptrHPGL < pEnd && (HPGLcharClass[ (guchar)*ptrHPGL ] & charClass) == 0 )
+        ptrHPGL++;
+    return ptrHPGL;
+}
+
+/*!     \brief  Parse a buffer of HPGL from a stream
+ *
  * HPGL can have several forms.. eg:
  * PDPU10,20
  * PDlPU10,20;
@@ -583,17 +1240,267 @@ parseHPGLcmd( guint16 HPGLcmd, gchar *sHPGLargs, tGlobal *pGlobal ) {
  *
  * Parse the input data and break into individual commands.
  * The HPGL commands may be terminated with a semicolon or the next command (2 upper case characters)
+ * The arguments are passed to parseHPGLcmd() as a span of the input buffer; they are only
+ * copied if a command is split between this buffer and the next.
+ *
+ * \param pParser       : pointer to the parser for this stream
+ * \param sHPGLserial   : pointer to the HPGL
+ * \param serialLength  : number of characters of HPGL
+ * \return TRUE if the pen has been parked (often the end of the plot)
  */
 gboolean
-deserializeHPGL( gchar *sHPGLserial, tGlobal *pGlobal ) {
-    static guint16  HPGLcmd = 0;
-    static GString	*HPGLcmdArgs = 0;
+parseHPGLstream( tHPGLParser *pParser, const gchar *sHPGLserial, gsize serialLength ) {
     gboolean bPenParked = FALSE;
 
-    gchar *ptrHPGL = sHPGLserial;
+    const gchar *ptrHPGL = sHPGLserial, *pEnd = sHPGLserial + serialLength, *pArgsEnd;
 #define FIRSTcmdBYTE	0xFF00
 #define SECONDcmdBYTE	0x00FF
 
+    while( ptrHPGL < pEnd ) {
+        // are we looking for the command
+        if( (pParser->HPGLcmd & FIRSTcmdBYTE) == 0 ) {
+            // looking for first byte of two byte command
+            ptrHPGL = scanHPGL( ptrHPGL, pEnd, HPGL_CC_COMMAND );
+            if( ptrHPGL < pEnd )
+                pParser->HPGLcmd = *ptrHPGL++ << 8;
+        } else if( (pParser->HPGLcmd & SECONDcmdBYTE) == 0 ) {
+            if( g_ascii_isupper( *ptrHPGL ) ) {
+                pParser->HPGLcmd |= *ptrHPGL;
+            } else {
+                pParser->HPGLcmd = 0;	// reset.. we need two character in a row
+            }
+            ptrHPGL++;
+        } else {
+            const tHPGLcommand *pCommand = lookupHPGLcmd( pParser->HPGLcmd );
+            gboolean bLabel = (pCommand->grammar == HPGL_ARGS_LABEL);
+            gboolean bIgnore = (pCommand->grammar == HPGL_ARGS_IGNORE);
+            GString *HPGLcmdArgs = pParser->HPGLcmdArgs;
+
+            // We have a command; the arguments run until a terminator.
+            // The label has its own terminator, otherwise it is a semicolon or
+            // the first character of the next command!
+            if( bLabel ) {
+                USE_HPGL_MODAL( pParser, HPGL_MODAL_TERMINATOR );
+                pArgsEnd = memchr( ptrHPGL, pParser->labelTerminator, pEnd - ptrHPGL );
+                if( pArgsEnd == NULL )
+                    pArgsEnd = pEnd;
+            } else {
+                pArgsEnd = scanHPGL( ptrHPGL, pEnd, HPGL_CC_TERMINATOR );
+            }
+
+            if( pArgsEnd == pEnd ) {
+                // The arguments continue in the next buffer .. hold on to what we have
+                // (unless we are going to ignore them anyway)
+                if( !bIgnore )
+                    g_string_append_len( HPGLcmdArgs, ptrHPGL, pArgsEnd - ptrHPGL );
+                ptrHPGL = pArgsEnd;
+            } else {
+                // this is the terminator .. now process this command
+                if( bIgnore ) {
+                    bPenParked = pParser->bPenParked;
+                } else if( HPGLcmdArgs->len == 0 ) {
+                    bPenParked = dispatchHPGLcmd( pParser, pCommand, ptrHPGL, pArgsEnd - ptrHPGL );
+                } else {
+                    g_string_append_len( HPGLcmdArgs, ptrHPGL, pArgsEnd - ptrHPGL );
+                    bPenParked = dispatchHPGLcmd( pParser, pCommand, HPGLcmdArgs->str, HPGLcmdArgs->len );
+                    g_string_truncate( HPGLcmdArgs, 0 );
+                }
+                // We need to keep the next command byte (if that is what is the terminator)
+                ptrHPGL = pArgsEnd;
+                if( bLabel || *ptrHPGL == ';' )
+                    ptrHPGL++;
+                pParser->HPGLcmd = 0;	// We will now look for the next command
+                pParser->nHPGLcommands++;
+            }
+        }
+    }
+    // everything compiled so far is whole commands (any partial command is still in HPGLcmdArgs)
+    completeCompiledHPGL( pParser->pCompiledHPGL );
+
+    return bPenParked;
+}
+
+// Files smaller than two pieces are parsed serially
+#define HPGL_MIN_PIECE_SIZE         (256 * 1024)
+#define HPGL_PIECES_PER_THREAD      4
+
+// A piece of a large HPGL stream being compiled on a worker thread
+typedef struct {
+    const gchar *sHPGL;             // the piece of the stream
+    gsize       length;
+    tCompiledHPGL compiledHPGL;     // compiled HPGL of the piece
+    tHPGLParser *pParser;           // starts with the modal state assumed at the start of the stream
+} tHPGLpiece;
+
+/*!     \brief  Compile a piece of an HPGL stream (thread pool function)
+ *
+ * \param data      : pointer to the piece (tHPGLpiece)
+ * \param user_data : not used
+ */
+static void
+parseHPGLpiece( gpointer data, gpointer user_data ) {
+    tHPGLpiece *pPiece = (tHPGLpiece *)data;
+
+    parseHPGLstream( pPiece->pParser, pPiece->sHPGL, pPiece->length );
+}
+
+/*!     \brief  Copy modal state from one parser to another
+ *
+ * \param pParser : parser to update
+ * \param pFrom   : parser to copy from (i.e. that compiled the following piece of the stream)
+ * \param modal   : the modal state to copy (HPGL_MODAL_...)
+ */
+static void
+carryHPGLmodalState( tHPGLParser *pParser, tHPGLParser *pFrom, guint8 modal ) {
+    if( modal & HPGL_MODAL_ABSOLUTE )
+        pParser->bAbsolutePoint = pFrom->bAbsolutePoint;
+    if( modal & HPGL_MODAL_CHARSET )
+        pParser->characterSet = pFrom->characterSet;
+    if( modal & HPGL_MODAL_TERMINATOR )
+        pParser->labelTerminator = pFrom->labelTerminator;
+    if( modal & HPGL_MODAL_PEN ) {
+        pParser->colour = pFrom->colour;
+        pParser->bPenParked = pFrom->bPenParked;
+    }
+    if( modal & HPGL_MODAL_CHARSIZE ) {
+        pParser->charSizeX = pFrom->charSizeX;
+        pParser->charSizeY = pFrom->charSizeY;
+    }
+    if( modal & HPGL_MODAL_LINETYPE )
+        pParser->lineType = pFrom->lineType;
+    pParser->modalUsed |= pFrom->modalUsed & ~pParser->modalSet;
+    pParser->modalSet |= modal;
+
+    // and any command left incomplete at the end of the piece
+    pParser->HPGLcmd = pFrom->HPGLcmd;
+    g_string_truncate( pParser->HPGLcmdArgs, 0 );
+    g_string_append_len( pParser->HPGLcmdArgs, pFrom->HPGLcmdArgs->str, pFrom->HPGLcmdArgs->len );
+}
+
+/*!     \brief  Was a piece compiled with the modal state it actually follows
+ *
+ * Only the modal state that changes the compiled HPGL (and that the piece
+ * used before setting it itself) matters.
+ *
+ * \param pParser  : parser holding the state at the start of the piece
+ * \param pAssumed : the state the piece was compiled with
+ * \param pPiece   : parser that compiled the piece
+ * \return TRUE if the compiled piece is good
+ */
+static gboolean
+isHPGLpieceValid( tHPGLParser *pParser, tHPGLParser *pAssumed, tHPGLParser *pPiece ) {
+    guint8 modalUsed = pPiece->modalUsed;
+
+    if( (modalUsed & HPGL_MODAL_ABSOLUTE) && pParser->bAbsolutePoint != pAssumed->bAbsolutePoint )
+        return FALSE;
+    if( (modalUsed & HPGL_MODAL_CHARSET) && pParser->characterSet != pAssumed->characterSet )
+        return FALSE;
+    if( (modalUsed & HPGL_MODAL_TERMINATOR) && pParser->labelTerminator != pAssumed->labelTerminator )
+        return FALSE;
+    return TRUE;
+}
+
+/*!     \brief  Parse a large buffer of HPGL on several threads
+ *
+ * The buffer is split into pieces after a ';' and the pieces are compiled on a thread pool,
+ * each assuming the modal state (absolute/relative, pen, character set and size, label terminator)
+ * that the parser has at the start of the buffer. The compiled pieces are then joined in order,
+ * carrying the modal state from one to the next. A piece that depended on state that turned out
+ * to be different (or that started in the middle of a label containing a ';') is parsed again
+ * serially with the correct state.
+ *
+ * No replies are sent to the instrument from the pieces, so this is meant for recalled files.
+ *
+ * \param pParser       : pointer to the parser for this stream
+ * \param sHPGLserial   : pointer to the HPGL
+ * \param serialLength  : number of characters of HPGL
+ * \return TRUE if the pen has been parked (often the end of the plot)
+ */
+gboolean
+parseHPGLstreamParallel( tHPGLParser *pParser, const gchar *sHPGLserial, gsize serialLength ) {
+    guint nThreads = g_get_num_processors();
+    guint nPieces = MIN( serialLength / HPGL_MIN_PIECE_SIZE, nThreads * HPGL_PIECES_PER_THREAD );
+    const gchar *pStart = sHPGLserial, *pEnd = sHPGLserial + serialLength, *pSplit;
+    tHPGLParser assumedState = *pParser;
+    GThreadPool *pool;
+    tHPGLpiece *pieces;
+    guint i, n;
+
+    if( nThreads < 2 || nPieces < 2 )
+        return parseHPGLstream( pParser, sHPGLserial, serialLength );
+
+    pool = g_thread_pool_new( parseHPGLpiece, NULL, nThreads, FALSE, NULL );
+    if( pool == NULL )
+        return parseHPGLstream( pParser, sHPGLserial, serialLength );
+
+    // split after a ';' close to each 1/nPieces of the buffer
+    pieces = g_new0( tHPGLpiece, nPieces );
+    for( n = 0; n < nPieces && pStart < pEnd; n++ ) {
+        // (the last split may already be past where this piece would end)
+        const gchar *pTarget = MAX( sHPGLserial + (n + 1) * (serialLength / nPieces), pStart );
+
+        pSplit = NULL;
+        if( n < nPieces - 1 )
+            pSplit = memchr( pTarget, ';', pEnd - pTarget );
+        pSplit = pSplit ? pSplit + 1 : pEnd;
+
+        pieces[ n ].sHPGL = pStart;
+        pieces[ n ].length = pSplit - pStart;
+        pieces[ n ].pParser = newHPGLparser( &pieces[ n ].compiledHPGL, FALSE, pParser->pGlobal );
+        pieces[ n ].pParser->flags.bWorker = TRUE;
+        carryHPGLmodalState( pieces[ n ].pParser, pParser, 0xFF );
+        pieces[ n ].pParser->modalSet = pieces[ n ].pParser->modalUsed = 0;
+        if( n > 0 ) {
+            // all but the first piece start after a ';' (i.e. not in a command)
+            pieces[ n ].pParser->HPGLcmd = 0;
+            g_string_truncate( pieces[ n ].pParser->HPGLcmdArgs, 0 );
+        }
+        g_thread_pool_push( pool, &pieces[ n ], NULL );
+        pStart = pSplit;
+    }
+    // wait for all the pieces
+    g_thread_pool_free( pool, FALSE, TRUE );
+
+    // join the pieces
+    for( i = 0; i < n; i++ ) {
+        tHPGLParser *pPiece = pieces[ i ].pParser;
+
+        if( (i == 0 || (pParser->HPGLcmd == 0 && pParser->HPGLcmdArgs->len == 0))
+                && isHPGLpieceValid( pParser, &assumedState, pPiece ) ) {
+            appendCompiledHPGL( pParser->pCompiledHPGL, &pieces[ i ].compiledHPGL );
+            carryHPGLmodalState( pParser, pPiece, pPiece->modalSet );
+        } else {
+            freeCompiledHPGL( &pieces[ i ].compiledHPGL );
+            parseHPGLstream( pParser, pieces[ i ].sHPGL, pieces[ i ].length );
+        }
+        freeHPGLparser( pPiece );
+    }
+    g_free( pieces );
+
+    // the pieces leave the global state alone
+    if( pParser->bPenParked && !pParser->flags.bWorker ) {
+        pParser->pGlobal->flags.bErasePrimed = TRUE;
+        postInfo("");
+    }
+
+    return pParser->bPenParked;
+}
+
+/*!     \brief  Parse HPGL received from the instrument
+ *
+ * The HPGL is added to the verbatim copy of the plot and compiled into
+ * the current plot with the global (GPIB) parser.
+ * The HPGL need not be null terminated (and may contain null characters).
+ *
+ * \param sHPGLserial  : pointer to the HPGL
+ * \param serialLength : number of characters of HPGL
+ * \param pGlobal      : pointer to global data
+ * \return TRUE if the pen has been parked (often the end of the plot)
+ */
+gboolean
+deserializeHPGL_n( const gchar *sHPGLserial, gsize serialLength, tGlobal *pGlobal ) {
+    gboolean bPenParked;
+
     // It may not be able to tell when the start of a new plot begins; therefore,
     //       if no HPGL is received in 250ms, we reset the plot (if the option is set)
     if( g_timer_elapsed( pGlobal->timeSinceLastHPGLcommand, NULL )
@@ -601,64 +1508,30 @@ deserializeHPGL( gchar *sHPGLserial, tGlobal *pGlobal ) {
         clearHPGL( pGlobal );
     }
 
-    // initialize HPGLcmdArgs if needed
-    if( HPGLcmdArgs == 0 )
-        HPGLcmdArgs = g_string_new(0);
-
     if( pGlobal->verbatimHPGLplot == NULL ) {
         pGlobal->verbatimHPGLplot = g_string_new(0);
         // If we have cleared the plot (either above or explicitly by pressing the button)
         // We also reset the accumulated command (in case there was some snippet partially accumulated)
-        HPGLcmd = 0;
-        g_string_truncate( HPGLcmdArgs, 0 );
+        pGlobal->pHPGLparser->HPGLcmd = 0;
+        g_string_truncate( pGlobal->pHPGLparser->HPGLcmdArgs, 0 );
     }
-    g_string_append( pGlobal->verbatimHPGLplot, sHPGLserial );
+    g_string_append_len( pGlobal->verbatimHPGLplot, sHPGLserial, serialLength );
 
     g_timer_start( pGlobal->timeSinceLastHPGLcommand );
 
-    while( *ptrHPGL != 0 ) {
-        // are we looking for the command
-        if( (HPGLcmd & FIRSTcmdBYTE) == 0 ) {
-            // looking for first byte of two byte command
-            if( g_ascii_isupper( *ptrHPGL ) ) {
-                HPGLcmd = *ptrHPGL << 8;
-            }
-            ptrHPGL++;
-        } else if( (HPGLcmd & SECONDcmdBYTE) == 0 ) {
-            if( g_ascii_isupper( *ptrHPGL ) ) {
-                HPGLcmd |= *ptrHPGL;
-            } else {
-                HPGLcmd = 0;	// reset.. we need two character in a row
-            }
-            ptrHPGL++;
-        } else if( HPGLcmd == HPGL_LABEL ) {	// special terminator for label
-            if( *ptrHPGL != labelTerminator ) {
-                HPGLcmdArgs = g_string_append_c( HPGLcmdArgs, *ptrHPGL );
-            } else {
-                // digest the HPGL command
-                bPenParked = parseHPGLcmd( HPGLcmd, HPGLcmdArgs->str, pGlobal );
-                g_string_truncate( HPGLcmdArgs, 0 );
-                HPGLcmd = 0;
-            }
-            ptrHPGL++;
-        } else {
-            // We have a command and are accumulating argument digits (or separator) until a terminator.
-            // the terminator could be the first character of the next command!
-            if( g_ascii_isupper( *ptrHPGL ) || *ptrHPGL == ';' ) {
-                // this is the terminator .. now process this command
-                bPenParked = parseHPGLcmd( HPGLcmd, HPGLcmdArgs->str, pGlobal );
-                g_string_truncate( HPGLcmdArgs, 0 );
-                // We need to keep the next command byte (if that is what is the terminator)
-                if( !g_ascii_isupper( *ptrHPGL ) )
-                    ptrHPGL++;
-                HPGLcmd = 0;	// We will now look for the next command
-            } else {
-                HPGLcmdArgs = g_string_append_c( HPGLcmdArgs, *ptrHPGL );
-                ptrHPGL++;
-            }
-        }
-    }
+    bPenParked = parseHPGLstream( pGlobal->pHPGLparser, sHPGLserial, serialLength );
 
     gtk_widget_set_sensitive( WLOOKUP( pGlobal, "btn_SaveHPGL" ), pGlobal->verbatimHPGLplot->len > 0 );
     return bPenParked;
 }
+
+/*!     \brief  Parse (null terminated) HPGL received from the instrument
+ *
+ * \param sHPGLserial : pointer to the (null terminated) HPGL
+ * \param pGlobal     : pointer to global data
+ * \return TRUE if the pen has been parked (often the end of the plot)
+ */
+gboolean
+deserializeHPGL( gchar *sHPGLserial, tGlobal *pGlobal ) {
+    return deserializeHPGL_n( sHPGLserial, strlen( sHPGLserial ), pGlobal );
+}
@@ -0,0 +1,861 @@
+/*
+ * Copyright (c) 2024 Michael G. Katzmann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*! \file renderThread.c
+ *  \brief Draw the plot for the screen away from the main loop
+ *
+ * When the drawing area is drawn it asks the render thread for an image of the
+ * plot (with the size of the area, the compiled HPGL added since the last request,
+ * the pen colours and the plotter sheet). The render thread keeps its own copy of
+ * the compiled HPGL and a recording of the plot, and draws the image from them.
+ * The newest image is handed back (under plotFrameMutex) and the drawing area
+ * only paints it, so a large plot does not hold up the main loop.
+ *
+ * The recording is kept a run (one pen select to the next) at a time. Instruments
+ * plot the same graticule and annotation with each sweep, so the runs of the last
+ * plot are kept and those sent again are not drawn again.
+ */
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <cairo/cairo.h>
+#include <glib-2.0/glib.h>
+#include <HPGLplotter.h>
+
+#include "messageEvent.h"
+
+// Width at which the plot on the screen is recorded (the height follows the aspect ratio)
+#define PLOT_CACHE_WIDTH    1000.0
+// Detail kept in the lines of the recording (fraction of a pixel of the drawing area)
+#define PLOT_CACHE_LOD      0.5
+// Time (ms) the size of the drawing area must be unchanged before the plot is drawn for it
+#define PLOT_RESIZE_SETTLE  150
+// Time (ms) to wait for the rest of a run that may be a run of the last plot before drawing it
+#define PLOT_RUN_HOLD       250
+
+// A run of the plot: the compiled HPGL from one pen select up to the next
+typedef struct {
+    gint            pen;                    // the pen it draws with
+    cairo_surface_t *recording;             // what it draws (opaque; see plotCompiledHPGLfrom())
+    cairo_surface_t *mask;                  // image of it for the screen (A8, only where it draws)
+    gdouble         maskX, maskY;           // where the image goes
+    tPlotRender     end;                    // the renderer state at the end of the run
+    guint           plot;                   // the last plot it was in
+} tPlotRun;
+
+// The plot as the render thread has it
+typedef struct {
+    tPlotSnapshot   snapshot;               // copy of the compiled HPGL, pens & plotter sheet
+    GHashTable      *runCache;              // runs of this plot and the last (keyed by the renderer
+                                            // state at the start and the compiled HPGL of the run)
+    GPtrArray       *plotRuns;              // the runs of this plot (in runCache)
+    tPlotRun        *openRun;               // the last run (until the pen select after it arrives)
+    gsize           openRunStart;
+    GByteArray      *openRunKey;            // the renderer state at its start
+    guint           plotCount;              // plots drawn
+    guint           pensUsed;               // pens drawn with (a bit for each pen)
+    gdouble         plotCacheWidth, plotCacheHeight;    // size the runs are recorded at
+    guint           plotCacheGeneration;    // of the compiled HPGL recorded
+    guint           plotCacheEpoch;         // of the plotter sheet recorded
+    gdouble         plotCacheLOD;           // detail kept in the lines of the recording
+    tPlotRender     plotCacheRender;        // where the recording is up to
+    cairo_surface_t *penMasks[ NUM_HPGL_PENS ];    // coverage of each pen in pixels of the screen (A8)
+    gint            penMaskWidth, penMaskHeight;
+    gdouble         penMaskScale;
+    cairo_surface_t *plotBacking;           // image of the plot (the last handed to the screen)
+    GdkRGBA         plotBackingPens[ NUM_HPGL_PENS ];  // colours it was composited with
+    guint           plotBackingHidden;      // pens left out of it
+} tScreenPlot;
+
+/*!     \brief  Free a request to the render thread
+ *
+ * \param pRequest      pointer to the request
+ */
+static void
+freeRenderRequest( tRenderRequest *pRequest ) {
+    if( pRequest->moreHPGL )
+        g_bytes_unref( pRequest->moreHPGL );
+    g_free( pRequest );
+}
+
+/*!     \brief  Discard the recording of the plot on the screen
+ *
+ * Call when the plotter sheet changes, so that the plot is recorded again.
+ * HPGL that arrives is added to the recording as it is, a plot that has been
+ * cleared is noticed by the draw, and new pen colours are only composited.
+ *
+ * \param pGlobal       pointer to the global data structure
+ */
+void
+invalidatePlotCache( tGlobal *pGlobal ) {
+    pGlobal->plotEpoch++;
+}
+
+/*!     \brief  Ask the render thread for an image of the plot (if it does not have one)
+ *
+ * Only the compiled HPGL added since the last request is sent.
+ *
+ * \param pGlobal       pointer to the global data structure
+ * \param areaWidth     width of the drawing area
+ * \param areaHeight    height of the drawing area
+ * \param scale         device pixels in a unit of the drawing area
+ */
+static void
+requestPlotFrame( tGlobal *pGlobal, gint areaWidth, gint areaHeight, gdouble scale ) {
+    tRenderRequest *pLast = &pGlobal->plotRequested;
+    tCompiledHPGL *pPlotHPGL = &pGlobal->plotHPGL;
+
+    // only whole commands .. and the GPIB thread may not move the plot while it is copied
+    lockCompiledHPGL( pPlotHPGL );
+    gsize length = pPlotHPGL->complete;
+    guint generation = pPlotHPGL->generation;
+    gboolean bNewPlot = generation != pGlobal->plotRequestedGeneration
+            || length < pGlobal->plotRequestedLength;
+    gboolean bRedraw = bNewPlot || pGlobal->plotEpoch != pLast->epoch
+            || areaWidth != pLast->width || areaHeight != pLast->height || scale != pLast->scale
+            || memcmp( pGlobal->HPGLpens, pLast->HPGLpens, sizeof( pLast->HPGLpens ) ) != 0
+            || pGlobal->hiddenPens != pLast->hiddenPens;
+    gsize from = bNewPlot ? 0 : pGlobal->plotRequestedLength;
+
+    if( !bRedraw && length == from ) {
+        unlockCompiledHPGL( pPlotHPGL );
+        return;     // the render thread has (or is drawing) this already
+    }
+
+    GBytes *moreHPGL = length > from ? g_bytes_new( pPlotHPGL->data + from, length - from )
+                                     : g_bytes_new( NULL, 0 );
+    unlockCompiledHPGL( pPlotHPGL );
+
+    tRenderRequest *pRequest = g_new0( tRenderRequest, 1 );
+    pRequest->serial = pLast->serial + 1;
+    pRequest->width = areaWidth;
+    pRequest->height = areaHeight;
+    pRequest->scale = scale;
+    pRequest->epoch = pGlobal->plotEpoch;
+    pRequest->bNewPlot = bNewPlot;
+    pRequest->moreHPGL = moreHPGL;
+    memcpy( pRequest->HPGLpens, pGlobal->HPGLpens, sizeof( pRequest->HPGLpens ) );
+    pRequest->hiddenPens = pGlobal->hiddenPens;
+    memcpy( pRequest->HPGLplotterP1P2, pGlobal->HPGLplotterP1P2, sizeof( pRequest->HPGLplotterP1P2 ) );
+
+    // an image drawn for an earlier request is now of the wrong plot, colours or size
+    if( bRedraw )
+        g_atomic_int_set( &pGlobal->plotStaleSerial, pRequest->serial );
+
+    *pLast = *pRequest;
+    pLast->moreHPGL = NULL;
+    pGlobal->plotRequestedLength = length;
+    pGlobal->plotRequestedGeneration = generation;
+
+    messageEventData *messageData = g_malloc0( sizeof(messageEventData) );
+    messageData->command = TR_RENDER;
+    messageData->data = pRequest;
+    g_async_queue_push( pGlobal->messageQueueToRender, messageData );
+}
+
+/*!     \brief  Add a request to the render thread's copy of the plot
+ *
+ * \param pScreen       pointer to the plot as the render thread has it
+ * \param pRequest      pointer to the request
+ */
+static void
+takeRenderRequest( tScreenPlot *pScreen, tRenderRequest *pRequest ) {
+    tCompiledHPGL *pPlotHPGL = &pScreen->snapshot.plotHPGL;
+    gsize size;
+    const guchar *pMoreHPGL = g_bytes_get_data( pRequest->moreHPGL, &size );
+
+    if( pRequest->bNewPlot )
+        clearCompiledHPGL( pPlotHPGL );
+    if( size > 0 ) {
+        memcpy( reserveCompiledHPGL( pPlotHPGL, size ), pMoreHPGL, size );
+        pPlotHPGL->length += size;
+    }
+    pPlotHPGL->complete = pPlotHPGL->length;
+
+    memcpy( pScreen->snapshot.HPGLpens, pRequest->HPGLpens, sizeof( pRequest->HPGLpens ) );
+    memcpy( pScreen->snapshot.HPGLplotterP1P2, pRequest->HPGLplotterP1P2, sizeof( pRequest->HPGLplotterP1P2 ) );
+}
+
+/*!     \brief  Free a run of the plot
+ *
+ * \param pRun          pointer to the run
+ */
+static void
+freePlotRun( gpointer pRun ) {
+    tPlotRun *pPlotRun = pRun;
+
+    if( pPlotRun->recording )
+        cairo_surface_destroy( pPlotRun->recording );
+    if( pPlotRun->mask )
+        cairo_surface_destroy( pPlotRun->mask );
+    freePlotRender( &pPlotRun->end );
+    g_free( pPlotRun );
+}
+
+/*!     \brief  Find the end of the run starting at a command
+ *
+ * \param plotHPGL      the compiled HPGL
+ * \param start         offset of the first command of the run
+ * \param length        length of the compiled HPGL
+ * \return offset of the next pen select (length if it has not arrived)
+ */
+static gsize
+findRunEnd( const guchar *plotHPGL, gsize start, gsize length ) {
+    gsize at = start < length ? nextCompiledHPGL( plotHPGL, start ) : length;
+
+    while( at < length && plotHPGL[ at ] != CHPGL_PEN )
+        at = nextCompiledHPGL( plotHPGL, at );
+    return MIN( at, length );
+}
+
+/*!     \brief  Draw compiled HPGL of the plot (continuing from where it is up to)
+ *
+ * A run draws with one pen, so it is drawn on one layer (in opaque black).
+ *
+ * \param pGlobal       pointer to the global data structure
+ * \param pScreen       pointer to the plot as the render thread has it
+ * \param end           draw the compiled HPGL up to here
+ * \return recording of what is drawn
+ */
+static cairo_surface_t *
+plotRunPart( tGlobal *pGlobal, tScreenPlot *pScreen, gsize end ) {
+    cairo_rectangle_t extents = { 0.0, 0.0, pScreen->plotCacheWidth, pScreen->plotCacheHeight };
+    cairo_surface_t *csRun = cairo_recording_surface_create( CAIRO_CONTENT_ALPHA, &extents );
+    cairo_t *crRun = cairo_create( csRun );
+    tPlotRender *pRender = &pScreen->plotCacheRender;
+
+    for( gint pen = 0; pen < NUM_HPGL_PENS; pen++ )
+        pRender->penLayers[ pen ] = crRun;
+    plotCompiledHPGLfrom( crRun, extents.width, extents.height, end, pRender, pGlobal );
+    for( gint pen = 0; pen < NUM_HPGL_PENS; pen++ )
+        pRender->penLayers[ pen ] = NULL;
+
+    cairo_destroy( crRun );
+    return csRun;
+}
+
+/*!     \brief  Paint a recording of the plot onto the image of a pen (if it has been made)
+ *
+ * \param pScreen       pointer to the plot as the render thread has it
+ * \param pen           the pen
+ * \param csRecording   the recording
+ */
+static void
+paintOnPenMask( tScreenPlot *pScreen, gint pen, cairo_surface_t *csRecording ) {
+    if( pScreen->penMasks[ pen ] ) {
+        cairo_t *crMask = cairo_create( pScreen->penMasks[ pen ] );
+        cairo_scale( crMask, pScreen->penMaskWidth / pScreen->plotCacheWidth,
+                pScreen->penMaskHeight / pScreen->plotCacheHeight );
+        cairo_set_source_surface( crMask, csRecording, 0.0, 0.0 );
+        cairo_paint( crMask );
+        cairo_destroy( crMask );
+    }
+}
+
+/*!     \brief  Get the image of a run (made from its recording if need be)
+ *
+ * The image only covers where the run draws, aligned to the pixels of the screen.
+ *
+ * \param pScreen       pointer to the plot as the render thread has it
+ * \param pRun          pointer to the run
+ * \return A8 image surface (placed at maskX, maskY)
+ */
+static cairo_surface_t *
+getRunMask( tScreenPlot *pScreen, tPlotRun *pRun ) {
+    if( pRun->mask == NULL ) {
+        gdouble scaleX = pScreen->penMaskWidth / pScreen->plotCacheWidth;
+        gdouble scaleY = pScreen->penMaskHeight / pScreen->plotCacheHeight;
+        gdouble scale = pScreen->penMaskScale;
+        gdouble x, y, width, height;
+        gint pixelX0, pixelY0, pixelX1, pixelY1;
+
+        cairo_recording_surface_ink_extents( pRun->recording, &x, &y, &width, &height );
+        pixelX0 = floor( x * scaleX * scale );
+        pixelY0 = floor( y * scaleY * scale );
+        pixelX1 = ceil( (x + width) * scaleX * scale );
+        pixelY1 = ceil( (y + height) * scaleY * scale );
+
+        pRun->mask = cairo_image_surface_create( CAIRO_FORMAT_A8,
+                MAX( pixelX1 - pixelX0, 1 ), MAX( pixelY1 - pixelY0, 1 ) );
+        cairo_surface_set_device_scale( pRun->mask, scale, scale );
+        pRun->maskX = pixelX0 / scale;
+        pRun->maskY = pixelY0 / scale;
+
+        cairo_t *crMask = cairo_create( pRun->mask );
+        cairo_translate( crMask, -pRun->maskX, -pRun->maskY );
+        cairo_scale( crMask, scaleX, scaleY );
+        cairo_set_source_surface( crMask, pRun->recording, 0.0, 0.0 );
+        cairo_paint( crMask );
+        cairo_destroy( crMask );
+    }
+    return pRun->mask;
+}
+
+/*!     \brief  Add a (whole) run to the plot
+ *
+ * \param pScreen       pointer to the plot as the render thread has it
+ * \param pRun          pointer to the run (in the run cache)
+ */
+static void
+addPlotRun( tScreenPlot *pScreen, tPlotRun *pRun ) {
+    pRun->plot = pScreen->plotCount;
+    g_ptr_array_add( pScreen->plotRuns, pRun );
+    pScreen->pensUsed |= 1 << pRun->pen;
+
+    if( pScreen->penMasks[ pRun->pen ] ) {
+        cairo_t *crMask = cairo_create( pScreen->penMasks[ pRun->pen ] );
+        cairo_set_source_surface( crMask, getRunMask( pScreen, pRun ), pRun->maskX, pRun->maskY );
+        cairo_paint( crMask );
+        cairo_destroy( crMask );
+    }
+}
+
+/*!     \brief  Discard the open run of the plot
+ *
+ * \param pScreen       pointer to the plot as the render thread has it
+ */
+static void
+clearOpenRun( tScreenPlot *pScreen ) {
+    g_clear_pointer( &pScreen->openRun, freePlotRun );
+    if( pScreen->openRunKey )
+        g_byte_array_free( pScreen->openRunKey, TRUE );
+    pScreen->openRunKey = NULL;
+}
+
+/*!     \brief  Discard the images of the pens
+ *
+ * \param pScreen       pointer to the plot as the render thread has it
+ */
+static void
+clearPenMasks( tScreenPlot *pScreen ) {
+    for( gint pen = 0; pen < NUM_HPGL_PENS; pen++ )
+        g_clear_pointer( &pScreen->penMasks[ pen ], cairo_surface_destroy );
+}
+
+/*!     \brief  Discard the image of a run (g_hash_table_foreach function)
+ */
+static void
+clearRunMask( gpointer key, gpointer pRun, gpointer not_used ) {
+    g_clear_pointer( &((tPlotRun *)pRun)->mask, cairo_surface_destroy );
+}
+
+/*!     \brief  Is a run not in this plot or the last (g_hash_table_foreach_remove function)
+ */
+static gboolean
+isRunOld( gpointer key, gpointer pRun, gpointer pPlotCount ) {
+    return ((tPlotRun *)pRun)->plot + 1 < *(guint *)pPlotCount;
+}
+
+/*!     \brief  Start the plot for the screen again
+ *
+ * The runs of the last plot are kept if they can be drawn the same
+ * (it was recorded at the same size and with the same plotter sheet).
+ *
+ * \param pScreen       pointer to the plot as the render thread has it
+ * \param bKeepRuns     keep the runs of the last plot
+ */
+static void
+startScreenPlot( tScreenPlot *pScreen, gboolean bKeepRuns ) {
+    gdouble lodTolerance = pScreen->plotCacheRender.lodTolerance;
+
+    clearOpenRun( pScreen );
+    clearPenMasks( pScreen );
+    g_ptr_array_set_size( pScreen->plotRuns, 0 );
+    pScreen->plotCount++;
+    if( bKeepRuns )
+        g_hash_table_foreach_remove( pScreen->runCache, isRunOld, &pScreen->plotCount );
+    else
+        g_hash_table_remove_all( pScreen->runCache );
+
+    freePlotRender( &pScreen->plotCacheRender );
+    pScreen->plotCacheRender.bBatchPens = TRUE;
+    pScreen->plotCacheRender.lodTolerance = lodTolerance;
+    pScreen->plotCacheRender.pSnapshot = &pScreen->snapshot;
+    pScreen->plotCacheGeneration = pScreen->snapshot.plotHPGL.generation;
+    pScreen->pensUsed = 0;
+}
+
+// The start of a run (see isRunStartOf())
+typedef struct {
+    const GByteArray *state;                // the renderer state at its start
+    const guchar    *plotHPGL;              // the compiled HPGL of it that has arrived
+    gsize           length;
+} tRunStart;
+
+/*!     \brief  Is a run in the cache one that starts like this (g_hash_table_find function)
+ */
+static gboolean
+isRunStartOf( gpointer key, gpointer pRun, gpointer pRunStart ) {
+    const tRunStart *pStart = pRunStart;
+    gsize keyLength;
+    const guchar *keyData = g_bytes_get_data( key, &keyLength );
+
+    return keyLength >= pStart->state->len + pStart->length
+            && memcmp( keyData, pStart->state->data, pStart->state->len ) == 0
+            && memcmp( keyData + pStart->state->len, pStart->plotHPGL, pStart->length ) == 0;
+}
+
+/*!     \brief  Is there a run in the cache that starts like this
+ *
+ * \param pScreen       pointer to the plot as the render thread has it
+ * \param state         the renderer state at the start (see appendPlotRenderState())
+ * \param plotHPGL      the compiled HPGL of the run that has arrived
+ * \param length        its length
+ * \return TRUE if there is
+ */
+static gboolean
+isRunCached( tScreenPlot *pScreen, const GByteArray *state, const guchar *plotHPGL, gsize length ) {
+    tRunStart runStart = { state, plotHPGL, length };
+
+    return g_hash_table_find( pScreen->runCache, isRunStartOf, &runStart ) != NULL;
+}
+
+/*!     \brief  Draw the compiled HPGL that has not been drawn yet
+ *
+ * The plot is taken a run at a time. A whole run that was in this plot or the last,
+ * drawn from the same renderer state, is taken from the run cache (with the renderer
+ * state at its end); otherwise it is drawn and added to the cache. The last run
+ * may not have all arrived yet, so it is drawn as it arrives and cached once the
+ * pen select after it arrives. If what has arrived of it is the start of a run
+ * in the cache, it may be held back until the rest arrives.
+ *
+ * \param pGlobal       pointer to the global data structure
+ * \param pScreen       pointer to the plot as the render thread has it
+ * \param bHold         hold back the last run if it may be a run in the cache
+ * \return TRUE if the last run is held back
+ */
+static gboolean
+addScreenPlot( tGlobal *pGlobal, tScreenPlot *pScreen, gboolean bHold ) {
+    const guchar *plotHPGL = pScreen->snapshot.plotHPGL.data;
+    gsize length = pScreen->snapshot.plotHPGL.length;
+    tPlotRender *pRender = &pScreen->plotCacheRender;
+
+    while( pRender->HPGLserialCount < length ) {
+        gsize start = pScreen->openRun ? pScreen->openRunStart : pRender->HPGLserialCount;
+        gsize end = findRunEnd( plotHPGL, start, length );
+        cairo_surface_t *csMore;
+        tPlotRun *pRun;
+
+        if( pScreen->openRun == NULL ) {
+            GByteArray *key = g_byte_array_new();
+            appendPlotRenderState( key, pRender );
+
+            if( end < length ) {
+                // a whole run .. has it been drawn before?
+                g_byte_array_append( key, plotHPGL + start, end - start );
+                GBytes *runKey = g_byte_array_free_to_bytes( key );
+
+                pRun = g_hash_table_lookup( pScreen->runCache, runKey );
+                if( pRun ) {
+                    copyPlotRender( pRender, &pRun->end );
+                    pRender->HPGLserialCount = end;
+                    pRender->pSnapshot = &pScreen->snapshot;
+                    g_bytes_unref( runKey );
+                } else {
+                    pRun = g_new0( tPlotRun, 1 );
+                    pRun->recording = plotRunPart( pGlobal, pScreen, end );
+                    pRun->pen = pRender->HPGLpen < NUM_HPGL_PENS ? pRender->HPGLpen : 1;
+                    copyPlotRender( &pRun->end, pRender );
+                    g_hash_table_insert( pScreen->runCache, runKey, pRun );
+                }
+                addPlotRun( pScreen, pRun );
+                continue;
+            }
+
+            // the end of the run has not arrived yet .. if it may be a run
+            // drawn before, wait for the rest of it (nothing of it is drawn)
+            if( bHold && isRunCached( pScreen, key, plotHPGL + start, length - start ) ) {
+                g_byte_array_free( key, TRUE );
+                return TRUE;
+            }
+            cairo_rectangle_t extents = { 0.0, 0.0, pScreen->plotCacheWidth, pScreen->plotCacheHeight };
+            pScreen->openRun = g_new0( tPlotRun, 1 );
+            pScreen->openRun->recording = cairo_recording_surface_create( CAIRO_CONTENT_ALPHA, &extents );
+            pScreen->openRunStart = start;
+            pScreen->openRunKey = key;
+        }
+
+        // draw more of the open run
+        pRun = pScreen->openRun;
+        csMore = plotRunPart( pGlobal, pScreen, end );
+        pRun->pen = pRender->HPGLpen < NUM_HPGL_PENS ? pRender->HPGLpen : 1;
+        pScreen->pensUsed |= 1 << pRun->pen;
+
+        cairo_t *crRun = cairo_create( pRun->recording );
+        cairo_set_source_surface( crRun, csMore, 0.0, 0.0 );
+        cairo_paint( crRun );
+        cairo_destroy( crRun );
+        paintOnPenMask( pScreen, pRun->pen, csMore );
+        cairo_surface_destroy( csMore );
+
+        if( end < length ) {
+            // the run is whole now
+            g_byte_array_append( pScreen->openRunKey, plotHPGL + pScreen->openRunStart, end - pScreen->openRunStart );
+            GBytes *runKey = g_byte_array_free_to_bytes( pScreen->openRunKey );
+            tPlotRun *pCached = g_hash_table_lookup( pScreen->runCache, runKey );
+
+            pScreen->openRunKey = NULL;
+            pScreen->openRun = NULL;
+            if( pCached ) {
+                // (already cached from earlier in the plot)
+                freePlotRun( pRun );
+                g_bytes_unref( runKey );
+                pRun = pCached;
+            } else {
+                copyPlotRender( &pRun->end, pRender );
+                g_hash_table_insert( pScreen->runCache, runKey, pRun );
+            }
+            pRun->plot = pScreen->plotCount;
+            g_ptr_array_add( pScreen->plotRuns, pRun );
+        }
+    }
+    return FALSE;
+}
+
+/*!     \brief  Get the image of a pen (made from the runs if need be)
+ *
+ * \param pScreen       pointer to the plot as the render thread has it
+ * \param pen           the pen
+ * \return A8 image surface of the coverage of the pen
+ */
+static cairo_surface_t *
+getPenMask( tScreenPlot *pScreen, gint pen ) {
+    if( pScreen->penMasks[ pen ] == NULL ) {
+        cairo_surface_t *csMask = cairo_image_surface_create( CAIRO_FORMAT_A8,
+                ceil( pScreen->penMaskWidth * pScreen->penMaskScale ),
+                ceil( pScreen->penMaskHeight * pScreen->penMaskScale ) );
+        cairo_surface_set_device_scale( csMask, pScreen->penMaskScale, pScreen->penMaskScale );
+
+        cairo_t *crMask = cairo_create( csMask );
+        for( guint i = 0; i < pScreen->plotRuns->len; i++ ) {
+            tPlotRun *pRun = g_ptr_array_index( pScreen->plotRuns, i );
+            if( pRun->pen == pen ) {
+                cairo_set_source_surface( crMask, getRunMask( pScreen, pRun ), pRun->maskX, pRun->maskY );
+                cairo_paint( crMask );
+            }
+        }
+        cairo_destroy( crMask );
+
+        pScreen->penMasks[ pen ] = csMask;
+        if( pScreen->openRun && pScreen->openRun->pen == pen )
+            paintOnPenMask( pScreen, pen, pScreen->openRun->recording );
+    }
+    return pScreen->penMasks[ pen ];
+}
+
+/*!     \brief  Make the image of the plot for the screen
+ *
+ * The image of each pen shown is painted in the colour of the pen.
+ * This does not depend on how much is plotted, so changing a colour
+ * or showing or hiding a pen is quick.
+ * The image is new each time (the last may still be on the screen).
+ *
+ * \param pGlobal       pointer to the global data structure
+ * \param pScreen       pointer to the plot as the render thread has it
+ * \param pRequest      pointer to the request (size, colours and pens shown)
+ */
+static void
+makePlotBacking( tGlobal *pGlobal, tScreenPlot *pScreen, tRenderRequest *pRequest ) {
+    cairo_surface_t *csBacking = cairo_image_surface_create( CAIRO_FORMAT_ARGB32,
+            ceil( pRequest->width * pRequest->scale ), ceil( pRequest->height * pRequest->scale ) );
+    cairo_surface_set_device_scale( csBacking, pRequest->scale, pRequest->scale );
+    cairo_t *crBacking = cairo_create( csBacking );
+
+    if( pScreen->snapshot.plotHPGL.length == 0 ) {
+        // nothing plotted (the logo)
+        tPlotRender render = { .pSnapshot = &pScreen->snapshot };
+        plotCompiledHPGLfrom( crBacking, pRequest->width, pRequest->height, 0, &render, pGlobal );
+        freePlotRender( &render );
+    } else {
+        for( gint pen = 0; pen < NUM_HPGL_PENS; pen++ ) {
+            if( (pScreen->pensUsed & ~pRequest->hiddenPens) & (1 << pen) ) {
+                gdk_cairo_set_source_rgba( crBacking, &pRequest->HPGLpens[ pen ] );
+                cairo_mask_surface( crBacking, getPenMask( pScreen, pen ), 0.0, 0.0 );
+            }
+        }
+    }
+    cairo_destroy( crBacking );
+
+    if( pScreen->plotBacking )
+        cairo_surface_destroy( pScreen->plotBacking );
+    pScreen->plotBacking = csBacking;
+    memcpy( pScreen->plotBackingPens, pRequest->HPGLpens, sizeof( pScreen->plotBackingPens ) );
+    pScreen->plotBackingHidden = pRequest->hiddenPens;
+}
+
+/*!     \brief  Draw the image of the plot for a request and hand it to the screen
+ *
+ * The image is dropped if a later request has made it stale
+ * (a new plot, new colours or a new size).
+ *
+ * \param pGlobal       pointer to the global data structure
+ * \param pScreen       pointer to the plot as the render thread has it
+ * \param pRequest      pointer to the (newest) request
+ * \param bHold         hold back the last run if it may be a run in the cache
+ * \return TRUE if the last run is held back (draw again if the rest does not arrive)
+ */
+static gboolean
+renderScreenPlot( tGlobal *pGlobal, tScreenPlot *pScreen, tRenderRequest *pRequest, gboolean bHold ) {
+    gsize length = pScreen->snapshot.plotHPGL.length;
+    gsize drawn = pScreen->plotCacheRender.HPGLserialCount;
+    gint areaWidth = pRequest->width, areaHeight = pRequest->height;
+    gdouble lodTolerance;
+    gboolean bComposite = FALSE, bHeld = FALSE;
+
+    // The detail needed in the lines of the recording for the pixels across the area.
+    // The pixels are rounded up to a power of two, so the recording is only made again
+    // when the area grows past the level of detail it was made for.
+    lodTolerance = PLOT_CACHE_LOD * PLOT_CACHE_WIDTH
+            / exp2( ceil( log2( MAX( areaWidth * pRequest->scale, 256.0 ) ) ) );
+
+    if( pScreen->penMaskWidth != areaWidth || pScreen->penMaskHeight != areaHeight
+            || pScreen->penMaskScale != pRequest->scale ) {
+        clearPenMasks( pScreen );
+        g_hash_table_foreach( pScreen->runCache, clearRunMask, NULL );
+        pScreen->penMaskWidth = areaWidth;
+        pScreen->penMaskHeight = areaHeight;
+        pScreen->penMaskScale = pRequest->scale;
+        bComposite = TRUE;
+    }
+
+    // Record the plot again from nothing if the sheet has changed, the shape of the
+    // area has changed (the aspect frame keeps it unless the sheet orientation changed)
+    // or the area needs more detail. A new plot keeps the runs of the last.
+    if( pScreen->plotCacheWidth == 0.0
+            || pScreen->plotCacheEpoch != pRequest->epoch
+            || fabs( pScreen->plotCacheWidth * areaHeight / (pScreen->plotCacheHeight * areaWidth) - 1.0 ) > 0.01
+            || lodTolerance < pScreen->plotCacheLOD ) {
+        pScreen->plotCacheWidth = PLOT_CACHE_WIDTH;
+        pScreen->plotCacheHeight = PLOT_CACHE_WIDTH * areaHeight / areaWidth;
+        pScreen->plotCacheEpoch = pRequest->epoch;
+        pScreen->plotCacheLOD = lodTolerance;
+        pScreen->plotCacheRender.lodTolerance = lodTolerance;
+        startScreenPlot( pScreen, FALSE );
+        bComposite = TRUE;
+    } else if( pScreen->plotCacheGeneration != pScreen->snapshot.plotHPGL.generation || length < drawn ) {
+        startScreenPlot( pScreen, TRUE );
+        bComposite = TRUE;
+    }
+
+    if( length > pScreen->plotCacheRender.HPGLserialCount ) {
+        bHeld = addScreenPlot( pGlobal, pScreen, bHold );
+        bComposite = TRUE;
+    }
+
+    // new colours or pens shown only need the images of the pens composited again
+    if( bComposite || pScreen->plotBacking == NULL
+            || memcmp( pScreen->plotBackingPens, pRequest->HPGLpens, sizeof( pScreen->plotBackingPens ) ) != 0
+            || pScreen->plotBackingHidden != pRequest->hiddenPens )
+        makePlotBacking( pGlobal, pScreen, pRequest );
+
+    if( pRequest->serial < g_atomic_int_get( &pGlobal->plotStaleSerial ) )
+        return bHeld;
+
+    g_mutex_lock( &pGlobal->plotFrameMutex );
+    if( pGlobal->plotFrame )
+        cairo_surface_destroy( pGlobal->plotFrame );
+    pGlobal->plotFrame = cairo_surface_reference( pScreen->plotBacking );
+    pGlobal->plotFrameWidth = areaWidth;
+    pGlobal->plotFrameHeight = areaHeight;
+    g_mutex_unlock( &pGlobal->plotFrameMutex );
+
+    postMessageToMainLoop( TM_REFRESH_PLOT, NULL );
+    return bHeld;
+}
+
+/*!     \brief  Thread to draw the plot for the screen
+ *
+ * Waits for requests from the drawing area (see requestPlotFrame()).
+ * All the requests waiting are taken before drawing, so only the newest is drawn.
+ * A run held back (see addScreenPlot()) is drawn if no request follows in PLOT_RUN_HOLD ms.
+ *
+ * \param _pGlobal : pointer to structure holding global variables
+ * \return       NULL
+ */
+gpointer
+threadRender( gpointer _pGlobal ) {
+    tGlobal *pGlobal = (tGlobal*) _pGlobal;
+    tScreenPlot screen = {0};
+    tRenderRequest request = {0};
+    messageEventData *message;
+    gboolean bRunning = TRUE, bRequest = FALSE, bHeld = FALSE;
+
+    screen.runCache = g_hash_table_new_full( g_bytes_hash, g_bytes_equal,
+            (GDestroyNotify)g_bytes_unref, freePlotRun );
+    screen.plotRuns = g_ptr_array_new();
+
+    while ( bRunning ) {
+        if( bRequest )
+            message = g_async_queue_try_pop( pGlobal->messageQueueToRender );
+        else if( bHeld )
+            message = g_async_queue_timeout_pop( pGlobal->messageQueueToRender, PLOT_RUN_HOLD * 1000 );
+        else
+            message = g_async_queue_pop( pGlobal->messageQueueToRender );
+
+        if( message ) {
+            switch( message->command ) {
+            case TR_END:
+                bRunning = FALSE;
+                break;
+            case TR_RENDER:
+                takeRenderRequest( &screen, message->data );
+                request = *(tRenderRequest *)message->data;
+                request.moreHPGL = NULL;
+                bRequest = TRUE;
+                break;
+            default:
+                break;
+            }
+            if( message->command == TR_RENDER )
+                freeRenderRequest( message->data );
+            g_free( message );
+            continue;
+        }
+
+        // no more requests waiting .. draw the newest
+        // (or, if the rest of a run held back has not arrived, draw it now)
+        bHeld = renderScreenPlot( pGlobal, &screen, &request, bRequest );
+        bRequest = FALSE;
+    }
+
+    clearOpenRun( &screen );
+    clearPenMasks( &screen );
+    g_ptr_array_unref( screen.plotRuns );
+    g_hash_table_destroy( screen.runCache );
+    if( screen.plotBacking )
+        cairo_surface_destroy( screen.plotBacking );
+    freePlotRender( &screen.plotCacheRender );
+    freeCompiledHPGL( &screen.snapshot.plotHPGL );
+
+    LOG( G_LOG_LEVEL_INFO, "threadRender ending");
+    return NULL;
+}
+
+/*!     \brief  The drawing area has stopped changing size
+ *
+ * Draw it again so the plot is drawn for the new size.
+ *
+ * \param  gpGlobal     pointer to the global data structure
+ * \return G_SOURCE_REMOVE (do not restart)
+ */
+static gboolean
+plotResizeSettled( gpointer gpGlobal ) {
+    tGlobal *pGlobal = (tGlobal *)gpGlobal;
+
+    pGlobal->plotResizeTimer = 0;
+    gtk_widget_queue_draw( WLOOKUP( pGlobal, "drawing_Plot" ) );
+    return G_SOURCE_REMOVE;
+}
+
+/*!     \brief  Note the size the drawing area is being resized to
+ *
+ * While the window is being resized the drawing area is drawn at every size
+ * it passes through. The plot is only drawn again when the size has not changed
+ * for PLOT_RESIZE_SETTLE ms; until then the last image is stretched to fit.
+ *
+ * \param pGlobal       pointer to the global data structure
+ * \param areaWidth     width of the drawing area
+ * \param areaHeight    height of the drawing area
+ * \return TRUE if the area is still being resized
+ */
+static gboolean
+isPlotResizing( tGlobal *pGlobal, gint areaWidth, gint areaHeight ) {
+    tRenderRequest *pLast = &pGlobal->plotRequested;
+
+    // the first image, or the size the plot was last drawn for
+    if( pLast->serial == 0 || (areaWidth == pLast->width && areaHeight == pLast->height) ) {
+        if( pGlobal->plotResizeTimer )
+            g_source_remove( pGlobal->plotResizeTimer );
+        pGlobal->plotResizeTimer = 0;
+        return FALSE;
+    }
+
+    if( areaWidth != pGlobal->plotResizeWidth || areaHeight != pGlobal->plotResizeHeight ) {
+        // a new size .. (re)start the wait for it to settle
+        if( pGlobal->plotResizeTimer )
+            g_source_remove( pGlobal->plotResizeTimer );
+        pGlobal->plotResizeWidth = areaWidth;
+        pGlobal->plotResizeHeight = areaHeight;
+        pGlobal->plotResizeTimer = g_timeout_add( PLOT_RESIZE_SETTLE, plotResizeSettled, pGlobal );
+    }
+
+    // still resizing until the wait is over
+    return pGlobal->plotResizeTimer != 0;
+}
+
+/*!     \brief  Signal received to draw the first drawing area
+ *
+ * Draw the plot for area A.
+ * The image is drawn by the render thread; here it is only asked for
+ * and the newest image there is painted (stretched if it was drawn for
+ * another size, until the image for this size is ready).
+ * While the window is being resized no image is asked for until the size settles.
+ *
+ * \param widget        pointer to GtkDrawingArea widget
+ * \param cr            pointer to cairo structure
+ * \param areaWidth     width
+ * \param areaHeight    height
+ * \param pGlobal       pointer to the global data structure
+ */
+void
+CB_DrawingArea_Draw (GtkDrawingArea *widget, cairo_t *cr,
+        gint areaWidth, gint areaHeight, gpointer gpGlobal)
+{
+    tGlobal *pGlobal = (tGlobal *)gpGlobal;
+    cairo_surface_t *csFrame = NULL;
+    gint frameWidth = 0, frameHeight = 0;
+    gdouble scaleX, scaleY;
+    gboolean bResizing;
+
+    // clear the screen
+    if( pGlobal->flags.bAutoClear || pGlobal->plotHPGL.length == 0 ) {
+        cairo_set_source_rgba (cr, 1.0, 1.0, 1.0, 1.0 );
+        cairo_paint( cr );
+    }
+
+    if( areaWidth <= 0 || areaHeight <= 0 )
+        return;
+
+    // match the pixels of the screen (i.e. HiDPI)
+    cairo_surface_get_device_scale( cairo_get_target( cr ), &scaleX, &scaleY );
+    bResizing = isPlotResizing( pGlobal, areaWidth, areaHeight );
+    if( !bResizing )
+        requestPlotFrame( pGlobal, areaWidth, areaHeight, scaleX );
+
+    g_mutex_lock( &pGlobal->plotFrameMutex );
+    if( pGlobal->plotFrame ) {
+        csFrame = cairo_surface_reference( pGlobal->plotFrame );
+        frameWidth = pGlobal->plotFrameWidth;
+        frameHeight = pGlobal->plotFrameHeight;
+    }
+    g_mutex_unlock( &pGlobal->plotFrameMutex );
+
+    if( csFrame ) {
+        cairo_save( cr ); {
+            if( frameWidth != areaWidth || frameHeight != areaHeight )
+                cairo_scale( cr, (gdouble)areaWidth / frameWidth, (gdouble)areaHeight / frameHeight );
+            cairo_set_source_surface( cr, csFrame, 0.0, 0.0 );
+            // a quick stretch while the window is being resized
+            if( bResizing )
+                cairo_pattern_set_filter( cairo_get_source( cr ), CAIRO_FILTER_FAST );
+            cairo_paint( cr );
+        } cairo_restore( cr );
+        cairo_surface_destroy( csFrame );
+    }
+}
@@ -94,6 +94,9 @@ saveSettings( tGlobal *pGlobal ) {
     g_settings_set_boolean( gs, "auto-clear", pGlobal->flags.bAutoClear );
     g_settings_set_boolean( gs, "gpib-initial-listener", pGlobal->flags.bGPIB_InitialListener );
     g_settings_set_int( gs, "pdf-paper-size", pGlobal->PDFpaperSize );
+    g_settings_set_int( gs, "png-format", pGlobal->PNGformat );
+    g_settings_set_int( gs, "png-compression", pGlobal->PNGcompression );
+    g_settings_set_int( gs, "png-size", pGlobal->PNGsize );
 
     g_settings_set_boolean( gs, "online", pGlobal->flags.bOnline );
     //    g_variant_unref (gvPenColors);
@@ -148,6 +151,9 @@ recoverSettings( tGlobal *pGlobal ) {
         pGlobal->flags.bDoNotEnableSystemController = g_settings_get_boolean( gs, "gpib-do-not-enable-system" );
     pGlobal->flags.bAutoClear = g_settings_get_boolean( gs, "auto-clear" );
     pGlobal->PDFpaperSize = g_settings_get_int( gs, "pdf-paper-size" );
+    pGlobal->PNGformat = g_settings_get_int( gs, "png-format" );
+    pGlobal->PNGcompression = g_settings_get_int( gs, "png-compression" );
+    pGlobal->PNGsize = g_settings_get_int( gs, "png-size" );
 
     if( bOptOffline == INVALID )
         pGlobal->flags.bOnline = g_settings_get_boolean( gs, "online" );